@@ -15,15 +15,110 @@ class Hash
         uint64_t prime;
         uint64_t seed;
 
+        // modulus with precomputed constants for division-free reduction of 128-bit values below value * 2^64
+        struct Modulus
+        {
+            uint64_t value;
+            uint64_t ratio[2];    // floor((2^128-1) / value), for Barrett reduction
+            uint64_t neg_inverse; // -value^-1 mod 2^64, for Montgomery reduction of odd values
+
+            Modulus(){}
+            explicit Modulus(uint64_t value);
+            bool isOdd() const { return value & 1; }
+            bool isPowerOfTwo() const { return !(value & (value-1)); }
+            uint64_t montgomery(unsigned __int128 x) const;  // x * 2^-64 mod value, for odd values
+            uint64_t reduce(unsigned __int128 x) const;      // x mod value
+            uint64_t reduceNarrow(uint64_t x) const;         // x mod value, with one 64-bit product
+            uint64_t reduceWide(unsigned __int128 x) const;  // x mod value, with the full 128-bit Barrett reduction
+        };
+
+        // how hash reduces h * c1 + c0 modulo mod: a mask for a power of two, a 64-bit Barrett
+        // reduction when prime * mod fits in 64 bits, and the 128-bit one otherwise
+        enum class Reduction : uint8_t { mask, narrow, wide };
+
+        // coefficients reduced to their moduli (c2 and c3 in Montgomery form for odd primes)
+        // so every intermediate fits in 128 bits without wrapping
+        uint64_t c0, c1, c2, c3;
+        Modulus modulus_mod;
+        Modulus modulus_prime;
+        Reduction reduction;
+
+        void precompute();
+
+        template <bool Montgomery, Reduction R>
+        void hashKernel(const uint64_t * values, uint64_t count, uint64_t * hashes) const;
+
     public:
         Hash(){}
         Hash(const std::vector<uint64_t> & coeffs, uint64_t mod, uint64_t prime, uint64_t seed);
 
         uint64_t hash(uint64_t value) const;
+        void hash(const uint64_t * values, uint64_t count, uint64_t * hashes) const;
         uint64_t quickHash(uint64_t value) const;
+        void quickHash(const uint64_t * values, uint64_t count, uint64_t * hashes) const;
 
         friend std::istream & operator>>(std::istream & is, Hash & hash);
         friend std::ostream & operator<<(std::ostream & os, const Hash & hash);
 };
 
+// hot kernels are defined inline so the Cuckoo loops can keep the constants in registers
+
+// requires x < value * 2^64; the result is below 2 * value before the final subtraction
+inline uint64_t Hash::Modulus::montgomery(unsigned __int128 x) const
+{
+    uint64_t q = uint64_t(x) * neg_inverse;
+    uint64_t r = uint64_t((x + static_cast<unsigned __int128>(q) * value) >> 64);
+    return r - (value & -uint64_t(r >= value)); // branch-free, the comparison is random for hashed values
+}
+
+inline uint64_t Hash::Modulus::reduce(unsigned __int128 x) const
+{
+    return isPowerOfTwo() ? uint64_t(x) & (value-1) : reduceWide(x);
+}
+
+// ratio[1] is at most one below 2^64 / value, so for x < 2^64 the quotient estimate is at most one short
+inline uint64_t Hash::Modulus::reduceNarrow(uint64_t x) const
+{
+    uint64_t q = uint64_t((static_cast<unsigned __int128>(x) * ratio[1]) >> 64);
+    uint64_t r = x - q * value;
+    return r - (value & -uint64_t(r >= value));
+}
+
+// requires x < value * 2^64, so the quotient fits in 64 bits
+// the quotient estimate (bits [128, 192) of x * ratio) is at most one below the actual quotient
+inline uint64_t Hash::Modulus::reduceWide(unsigned __int128 x) const
+{
+    using u128 = unsigned __int128;
+    uint64_t lo = uint64_t(x), hi = uint64_t(x >> 64);
+    u128 lo_lo = u128(lo) * ratio[0];
+    u128 lo_hi = u128(lo) * ratio[1];
+    u128 hi_lo = u128(hi) * ratio[0];
+    u128 mid = (lo_lo >> 64) + uint64_t(lo_hi) + uint64_t(hi_lo);
+    uint64_t q = uint64_t(lo_hi >> 64) + uint64_t(hi_lo >> 64) + uint64_t(mid >> 64) + hi * ratio[1];
+    uint64_t r = lo - q * value;
+    return r - (value & -uint64_t(r >= value));
+}
+
+inline uint64_t Hash::hash(uint64_t value) const
+{
+    // sufficiently uniform and uncorrelated
+    // c3 < prime and c1 < mod, so both sums stay below modulus * 2^64 as long as prime < 2^63
+    using u128 = unsigned __int128;
+    u128 x = u128(c3) * (value ^ seed) + c2;
+    uint64_t h = modulus_prime.isOdd() ? modulus_prime.montgomery(x) : modulus_prime.reduce(x);
+    u128 y = u128(h) * c1 + c0;
+    switch (reduction)
+    {
+        case Reduction::mask: return uint64_t(y) & (mod-1);
+        case Reduction::narrow: return modulus_mod.reduceNarrow(uint64_t(y));
+        default: return modulus_mod.reduceWide(y);
+    }
+}
+
+inline uint64_t Hash::quickHash(uint64_t value) const
+{
+    // highly uniform, but not uncorrelated
+    return modulus_mod.reduce(static_cast<unsigned __int128>(value ^ seed) * c1 + c0);
+}
+
 } // cuckoo
\ No newline at end of file
@@ -6,34 +6,99 @@
 #include <iostream>
 #include <mutex>
 #include <random>
+#include <sstream>
 #include <stdexcept>
+#include <string>
 #include <thread>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 #include "math.h"
 #include "prime.h"
+#include "random.h"
 
 using namespace std;
 
 namespace cuckoo
 {
 
-// const uint64_t NUM_MUTEXES = 1<<8;
-// const uint64_t MUTEX_MASK = NUM_MUTEXES - 1;
-// vector<mutex> mtx (NUM_MUTEXES);
-// vector<atomic_flag> locks(NUM_MUTEXES);
-// vector<uint64_t> locks(NUM_MUTEXES, 0);
+// per-thread generator for the random walks of the insertion, which need speed rather than unpredictability
+// (the hash functions come from math::generator)
+static mt19937 & generator()
+{
+    thread_local mt19937 gen(random_device{}());
+    return gen;
+}
+
+// split [0, size) into one contiguous chunk per thread and call body(t, i) for every index i of chunk t
+template <class Body>
+void parallelFor(uint64_t size, uint64_t num_threads, Body body)
+{
+    num_threads = max<uint64_t>(min(num_threads, size), 1);
+    const uint64_t chunk = size / num_threads + bool(size % num_threads);
+    vector<thread> threads(num_threads);
+    for (uint64_t t = 0; t < num_threads; t++)
+    {
+        threads[t] = thread([t, chunk, size, &body]()
+        {
+            for (uint64_t i = t*chunk; i < min(size, (t+1)*chunk); i++) body(t, i);
+        });
+    }
+    for (thread & t : threads) t.join();
+}
+
+// parallel counting sort of 'values' into 'num_buckets' buckets given by 'key'
+// 'offsets' receives the first position of each bucket in the returned vector (plus the end)
+template <class Key>
+static vector<uint64_t> bucketSort(const vector<uint64_t> & values, uint64_t num_buckets, uint64_t num_threads, vector<uint64_t> & offsets, Key key)
+{
+    const uint64_t size = values.size();
+    num_threads = max<uint64_t>(min(num_threads, size), 1);
 
-Kuckoo::Kuckoo(uint64_t num_hashes, uint64_t table_size, uint64_t max_data, uint64_t threshold, uint64_t num_tables)
+    // count the bucket sizes of each chunk
+    vector<uint64_t> keys(size);
+    vector<vector<uint64_t>> counts(num_threads, vector<uint64_t>(num_buckets, 0));
+    parallelFor(size, num_threads, [&values, &keys, &counts, &key](uint64_t t, uint64_t i)
+    {
+        keys[i] = key(values[i]);
+        counts[t][keys[i]]++;
+    });
+
+    // exclusive prefix sum (bucket-major, chunk-minor) gives the write position of each chunk in each bucket
+    offsets.assign(num_buckets+1, 0);
+    uint64_t sum = 0;
+    for (uint64_t b = 0; b < num_buckets; b++)
+    {
+        offsets[b] = sum;
+        for (uint64_t t = 0; t < num_threads; t++)
+        {
+            uint64_t count = counts[t][b];
+            counts[t][b] = sum;
+            sum += count;
+        }
+    }
+    offsets[num_buckets] = sum;
+
+    // scatter the values into their buckets
+    vector<uint64_t> sorted(size);
+    parallelFor(size, num_threads, [&values, &keys, &counts, &sorted](uint64_t t, uint64_t i)
+    {
+        sorted[counts[t][keys[i]]++] = values[i];
+    });
+
+    return sorted;
+}
+
+// num_hashes hash functions onto num_bins bins with coprime moduli
+static vector<Hash> randomHashes(uint64_t num_hashes, uint64_t num_bins, uint64_t max_data)
 {
-    random_device rd;
-    mt19937 gen(rd());
+    auto & gen = math::generator();
 
-    uint64_t min_value = (table_size * table_size);   
-    uniform_int_distribution<uint64_t> dist_table(0, table_size-1);
+    uint64_t min_value = (num_bins * num_bins);   
+    uniform_int_distribution<uint64_t> dist_table(0, num_bins-1);
     uniform_int_distribution<uint64_t> dist_seeds(0, max_data);
 
-    // create hash functions for Cuckoo hashing
+    vector<Hash> hashes;
     vector<uint64_t> primes;
     for (uint64_t i = 0; i < num_hashes; i++)
     {
@@ -53,14 +118,29 @@ Kuckoo::Kuckoo(uint64_t num_hashes, uint64_t table_size, uint64_t max_data, uint
         uint64_t c2 = math::generatePrime(dist_prime(gen));
         uint64_t c3 = dist_prime(gen);
 
-        // c1 should not be a factor of table_size
+        // c1 should not be a factor of num_bins
         do { c1 = math::generatePrime(dist_table(gen)); }
-        while (table_size % c1 == 0);
+        while (num_bins % c1 == 0);
 
         vector<uint64_t> coeffs { c0,c1,c2,c3 };
 
-        hashes.push_back(Hash(coeffs, table_size, prime, seed));
+        hashes.push_back(Hash(coeffs, num_bins, prime, seed));
     }
+    return hashes;
+}
+
+Kuckoo::Kuckoo(uint64_t num_hashes, uint64_t table_size, uint64_t max_data, uint64_t threshold, uint64_t num_tables, uint64_t stash_size, uint64_t bin_width)
+{
+    // a bin spans bin_width consecutive slots, and must not straddle two ciphertexts
+    if (!bin_width || (bin_width & (bin_width-1)) || (bin_width > table_size)) throw runtime_error("Invalid bin width");
+    const uint64_t num_bins = table_size / bin_width;
+
+    auto & gen = math::generator();
+
+    uniform_int_distribution<uint64_t> dist_seeds(0, max_data);
+
+    // create hash functions for Cuckoo hashing
+    this->hashes = randomHashes(num_hashes, num_bins, max_data);
 
     // create hash for function g(x)
     {
@@ -81,53 +161,251 @@ Kuckoo::Kuckoo(uint64_t num_hashes, uint64_t table_size, uint64_t max_data, uint
         this->g = Hash(coeffs, mod, prime, seed);
     }
 
-    this->size_right = math::clog2(max_data+1ULL) - math::flog2(table_size);
+    this->size_right = math::clog2(max_data+1ULL) - math::flog2(num_bins);
     this->mask_right = math::shiftLeft(1ULL, size_right) - 1ULL;
+    this->size_left = math::flog2(num_bins);
+    this->bin_width = bin_width;
+    this->stash_size = stash_size;
     this->max_data = max_data & mask_right;
     this->invalid_data = this->max_data + 1ULL;
     this->num_hashes = num_hashes;
     this->threshold = threshold;
-    this->table_hashes = vector<vector<uint64_t>>(num_tables, vector<uint64_t>(table_size, num_hashes));
-    this->table_values = vector<vector<uint64_t>>(num_tables, vector<uint64_t>(table_size, invalid_data)); // initialize with max_data+1 (invalid value)
+    this->num_tables = num_tables;
+    this->table_size = table_size;
+
+    // an entry holds x_r (or max_data+1 for an empty slot) and the hash index (or num_hashes)
+    this->hash_bits = math::clog2(num_hashes + 1);
+    this->entry_bits = 1ULL << math::clog2(size_right + 1 + hash_bits);
+    if (entry_bits > 64) throw runtime_error("Table values do not fit in 64 bits");
+    uint64_t entries_per_word = 64 / entry_bits;
+    this->table_words = table_size / entries_per_word + bool(table_size % entries_per_word);
+    uint64_t empty = (invalid_data << hash_bits) | num_hashes;
+    uint64_t empty_word = 0;
+    for (uint64_t i = 0; i < entries_per_word; i++) empty_word |= empty << (i * entry_bits);
+    this->entries = vector<uint64_t, AlignedAllocator<uint64_t>>(num_tables * table_words, empty_word);
+    this->dirty_bins = vector<bool>(table_size, false);
+    this->dirty_stash = false;
 }
 
 Kuckoo::Kuckoo(const KuckooParameters & params)
 {
-    tie(g, hashes, max_data, invalid_data, num_hashes, threshold, size_right, mask_right) = params;
+    tie(g, hashes, max_data, invalid_data, num_hashes, threshold, size_right, mask_right, size_left, stash_size, bin_width) = params;
 }
 
-KuckooIndices Kuckoo::getIndices(uint64_t value) const
+// hash functions are shared by all tables until a table is rehashed, then every table has its own
+const Hash & Kuckoo::hashOf(uint64_t table_index, uint64_t hash_index) const
 {
-    uint64_t x_l = value >> size_right;
-    uint64_t x_r = value & mask_right;
+    return hashes[(hashes.size() > num_hashes) ? table_index * num_hashes + hash_index : hash_index];
+}
 
-    // map value to a table
-    uint64_t table_index = g.quickHash(value);
+void Kuckoo::clearDirtyBins()
+{
+    fill(dirty_bins.begin(), dirty_bins.end(), false);
+    dirty_stash = false;
+}
 
-    vector<uint64_t> indices(num_hashes);
-    for (uint64_t i = 0; i < num_hashes; i++)
-        indices[i] = x_l ^ hashes[i].hash(x_r);
+bool Kuckoo::contains(uint64_t value) const
+{
+    uint64_t table_index, slot_index;
+    return locate(value, table_index, slot_index) || (find(stash.begin(), stash.end(), value) != stash.end());
+}
+
+bool Kuckoo::erase(uint64_t value)
+{
+    uint64_t table_index, slot_index;
+    if (!locate(value, table_index, slot_index))
+    {
+        auto it = find(stash.begin(), stash.end(), value);
+        if (it == stash.end()) return false;
+        stash.erase(it);
+        dirty_stash = true;
+        return true;
+    }
+
+    setEntry(table_index, slot_index, (invalid_data << hash_bits) | num_hashes);
+    dirty_bins[slot_index] = true;
+    return true;
+}
+
+// slots changed by insertions and deletions since the last call to clearDirtyBins
+// a slot index covers the same slot in every table, as they are packed into the same plaintext slot
+vector<uint64_t> Kuckoo::getDirtyBins() const
+{
+    vector<uint64_t> bins;
+    for (uint64_t i = 0; i < dirty_bins.size(); i++)
+        if (dirty_bins[i]) bins.push_back(i);
+    return bins;
+}
+
+// whether the stash changed since the last call to clearDirtyBins
+bool Kuckoo::getDirtyStash() const
+{
+    return dirty_stash;
+}
 
+KuckooIndices Kuckoo::getIndices(uint64_t value) const
+{
+    uint64_t x_r, table_index;
+    vector<uint64_t> indices(num_hashes);
+    getIndices(&value, 1, &x_r, &table_index, indices.data());
     return make_tuple(x_r, table_index, indices);
 }
 
+void Kuckoo::getIndices(const uint64_t * values, uint64_t count, uint64_t * x_r, uint64_t * table_indices, uint64_t * indices) const
+{
+    switch (num_hashes)
+    {
+        case 2: indicesKernel<2>(values, count, x_r, table_indices, indices); break;
+        case 3: indicesKernel<3>(values, count, x_r, table_indices, indices); break;
+        case 4: indicesKernel<4>(values, count, x_r, table_indices, indices); break;
+        default: indicesKernel<0>(values, count, x_r, table_indices, indices);
+    }
+}
+
+template <uint64_t H>
+void Kuckoo::indicesKernel(const uint64_t * values, uint64_t count, uint64_t * x_r, uint64_t * table_indices, uint64_t * indices) const
+{
+    const uint64_t h = H ? H : num_hashes;
+
+    // map values to tables
+    g.quickHash(values, count, table_indices);
+    for (uint64_t i = 0; i < count; i++) x_r[i] = values[i] & mask_right;
+
+    // first slot of each candidate bin
+    if (hashes.size() <= num_hashes) // shared hash functions: hash all values at once
+    {
+        for (uint64_t j = 0; j < h; j++)
+        {
+            uint64_t * column = indices + j*count;
+            hashes[j].hash(x_r, count, column);
+            for (uint64_t i = 0; i < count; i++) column[i] = ((values[i] >> size_right) ^ column[i]) * bin_width;
+        }
+        return;
+    }
+    for (uint64_t i = 0; i < count; i++)
+    {
+        uint64_t x_l = values[i] >> size_right;
+        for (uint64_t j = 0; j < h; j++)
+            indices[j*count + i] = (x_l ^ hashOf(table_indices[i], j).hash(x_r[i])) * bin_width;
+    }
+}
+
+uint64_t Kuckoo::getBinWidth() const
+{
+    return bin_width;
+}
+
+uint64_t Kuckoo::getEvictions() const
+{
+    return evictions;
+}
+
+Insertion Kuckoo::getInsertion() const
+{
+    return insertion;
+}
+
+uint64_t Kuckoo::getRehashes() const
+{
+    return rehashes;
+}
+
 uint64_t Kuckoo::getNumHashes() const
 {
     return num_hashes;
 }
 
+uint64_t Kuckoo::getNumTables() const
+{
+    return num_tables;
+}
+
 KuckooParameters Kuckoo::getParameters() const
 {
-    return make_tuple(g, hashes, max_data, invalid_data, num_hashes, threshold, size_right, mask_right);
+    return make_tuple(g, hashes, max_data, invalid_data, num_hashes, threshold, size_right, mask_right, size_left, stash_size, bin_width);
+}
+
+const vector<uint64_t> & Kuckoo::getStash() const
+{
+    return stash;
 }
 
-const vector<vector<uint64_t>> & Kuckoo::getTable() const
+uint64_t Kuckoo::getStashSize() const
 {
-    return table_values;
+    return stash_size;
+}
+
+// x_r of the slots from 'offset' on, interleaved as packEncode expects (vs[j*num_tables + l] is slot offset+j of table l)
+// slots past the end of the tables are left untouched
+void Kuckoo::getSlots(uint64_t offset, vector<uint64_t> & vs) const
+{
+    uint64_t count = min(vs.size() / num_tables, table_size - min(offset, table_size));
+    switch (num_tables)
+    {
+        case 1: slotsKernel<1>(offset, count, vs); break;
+        case 2: slotsKernel<2>(offset, count, vs); break;
+        default: slotsKernel<0>(offset, count, vs);
+    }
+}
+
+template <uint64_t K>
+void Kuckoo::slotsKernel(uint64_t offset, uint64_t count, vector<uint64_t> & vs) const
+{
+    const uint64_t k = K ? K : num_tables;
+    for (uint64_t l = 0; l < k; l++)
+        for (uint64_t j = 0; j < count; j++)
+            vs[j*k + l] = getEntry(l, offset + j) >> hash_bits;
+}
+
+uint64_t Kuckoo::getTableSize() const
+{
+    return table_size;
+}
+
+// number of bits of the values stored in the table (x_l and x_r)
+uint64_t Kuckoo::getValueSize() const
+{
+    return size_left + size_right;
 }
 
 void Kuckoo::insert(uint64_t value)
 {
+    uint64_t leftover;
+    if (!place(value, leftover)) throw runtime_error("Cuckoo insertion failed");
+}
+
+// on failure, the table of 'value' gets new hash functions and all its values, including the one the
+// failed insertion evicted last, are inserted again, up to max_rehashes times (the other tables are left as they are)
+void Kuckoo::insert(uint64_t value, uint64_t num_threads, uint64_t max_rehashes)
+{
+    uint64_t leftover;
+    if (place(value, leftover)) return;
+    if (!max_rehashes) throw runtime_error("Cuckoo insertion failed");
+
+    uint64_t table_index = g.quickHash(value);
+    auto values = tableValues(table_index);
+    values.push_back(leftover);
+    rehash(table_index);
+    insert(values, num_threads, max_rehashes - 1);
+}
+
+// insert a value, and return false with the value left without a slot if the stash is full
+bool Kuckoo::place(uint64_t value, uint64_t & leftover)
+{
+    switch (num_hashes)
+    {
+        case 2: return insertKernel<2>(value, leftover);
+        case 3: return insertKernel<3>(value, leftover);
+        case 4: return insertKernel<4>(value, leftover);
+        default: return insertKernel<0>(value, leftover);
+    }
+}
+
+template <uint64_t H>
+bool Kuckoo::insertKernel(uint64_t value, uint64_t & leftover)
+{
+    const uint64_t h = H ? H : num_hashes;
+
     // map value to a table
     uint64_t table_index = g.quickHash(value);
     
@@ -135,25 +413,43 @@ void Kuckoo::insert(uint64_t value)
     uint64_t x_l = value >> size_right;
     uint64_t x_r = value & mask_right;
 
+    if ((insertion == Insertion::bfs) && insertPath<H>(table_index, x_l, x_r)) return true;
+
     // cascade insertion if the slot is occupied
-    uint64_t prev_hash_index = num_hashes;
+    uint64_t prev_hash_index = h;
     for (uint64_t i = 0; (x_r != invalid_data) && (i < threshold); i++)
     {
         uint64_t hash_index;
-        do { hash_index = rand() % num_hashes; } // select a random hash function
-        while (hash_index == prev_hash_index); // ensure that the same hash function is not selected twice
-        prev_hash_index = hash_index;
-
-        uint64_t bin_index = x_l ^ hashes[hash_index].hash(x_r); // index in the hash table given by x_l ^ H[i](x_r)
-        swap(table_hashes[table_index][bin_index], prev_hash_index); // insert hash_index into the table
-        swap(table_values[table_index][bin_index], x_r); // insert x_r into the table
+        if (insertion == Insertion::min_counter) hash_index = leastEvicted<H>(table_index, x_l, x_r, prev_hash_index);
+        else
+        {
+            do { hash_index = generator()() % h; } // select a random hash function
+            while (hash_index == prev_hash_index); // ensure that the same hash function is not selected twice
+        }
+
+        uint64_t bin_index = x_l ^ hashOf(table_index, hash_index).hash(x_r); // index in the hash table given by x_l ^ H[i](x_r)
+        uint64_t slot_index = freeSlot(table_index, bin_index); // an empty slot of the bin, or a random one
+        uint64_t evicted = getEntry(table_index, slot_index);
+        setEntry(table_index, slot_index, (x_r << hash_bits) | hash_index); // insert x_r and hash_index into the table
+        dirty_bins[slot_index] = true;
+        x_r = evicted >> hash_bits;
+        prev_hash_index = evicted & ((1ULL << hash_bits) - 1ULL);
 
         if (x_r != invalid_data)
-            x_l = bin_index ^ hashes[prev_hash_index].hash(x_r); // recover x_l
+        {
+            x_l = bin_index ^ hashOf(table_index, prev_hash_index).hash(x_r); // recover x_l
+            evictions++;
+        }
     }
 
-    if (x_r != invalid_data)
-        throw runtime_error("Cuckoo insertion failed");
+    if (x_r == invalid_data) return true;
+
+    // keep the evicted value in the stash if there is room left
+    leftover = (x_l << size_right) | x_r;
+    if (stash.size() == stash_size) return false;
+    stash.push_back(leftover);
+    dirty_stash = true;
+    return true;
 }
 
 void Kuckoo::insert(const vector<uint64_t> & set)
@@ -162,82 +458,459 @@ void Kuckoo::insert(const vector<uint64_t> & set)
        insert(value);
 }
 
+// on failure, the tables that could not take all their values get new hash functions and their values
+// are inserted again, up to max_rehashes times (the other tables, which a failure does not stop, are left as they are)
+void Kuckoo::insert(const vector<uint64_t> & set, uint64_t num_threads, uint64_t max_rehashes)
+{
+    vector<uint64_t> pending(set);
+    for (uint64_t attempt = 0; ; attempt++)
+    {
+        try { insert(pending, num_threads); return; }
+        catch (const runtime_error &) { if (attempt == max_rehashes) throw; }
+
+        vector<bool> failed(num_tables, false);
+        for (uint64_t value : set)
+            if (!contains(value)) failed[g.quickHash(value)] = true;
+        pending.clear();
+        for (uint64_t value : set)
+            if (failed[g.quickHash(value)]) pending.push_back(value);
+        for (uint64_t table_index = 0; table_index < num_tables; table_index++)
+            if (failed[table_index]) rehash(table_index);
+    }
+}
+
 void Kuckoo::insert(const vector<uint64_t> & set, uint64_t num_threads)
 {
-    num_threads = min(num_threads, table_values.size());
-    vector<thread> threads(num_threads);
-    vector<bool> failure(num_threads, false);
-    
-    for (uint64_t t = 0; t < num_threads; t++)
+    num_threads = max<uint64_t>(num_threads, 1);
+    const uint64_t log_num_bins = math::flog2(table_size / bin_width);
+    const uint64_t log_entries_per_word = math::flog2(64 / entry_bits);
+
+    // each table is split into bin ranges, and a bin range is owned by one thread at a time
+    // a range covers whole words, so owners never write to the same word
+    const uint64_t log_range_words = math::flog2(table_size) - min(math::flog2(table_size), log_entries_per_word);
+    const uint64_t log_ranges = min(min(log_num_bins, log_range_words), math::clog2(4 * num_threads));
+    const uint64_t num_ranges = 1ULL << log_ranges;
+    const uint64_t range_shift = log_num_bins - log_ranges;
+    const uint64_t num_buckets = num_tables * num_ranges;
+
+    // index in the hash table given by x_l ^ H[i](x_r)
+    auto bin = [this](uint64_t table_index, uint64_t value, uint64_t hash_index) -> uint64_t
+    { return (value >> size_right) ^ hashOf(table_index, hash_index).hash(value & mask_right); };
+
+    // greedy placement: in round j, the pending values are bucketed by table and by the bin range
+    // of their j-th candidate bin, and each thread fills the empty bins of the ranges it owns
+    vector<uint64_t> pending(set);
+    for (uint64_t j = 0; (j < num_hashes) && !pending.empty(); j++)
     {
-        threads[t] = thread
-        ([
-            this, t, &failure, &set
-        ]()
-        {
-            for (uint64_t j = t; j < set.size(); j++)
+        vector<uint64_t> offsets;
+        auto sorted = bucketSort
+        (
+            pending, num_buckets, num_threads, offsets,
+            [this, &bin, j, num_ranges, range_shift](uint64_t value) -> uint64_t
             {
-                // uint64_t u = t+1;
-                uint64_t value = set[j];
-
-                // map value to a table
                 uint64_t table_index = g.quickHash(value);
-                if (table_index != t) continue;
-                
-                // break value into left and right parts
-                uint64_t x_l = value >> size_right;
-                uint64_t x_r = value & mask_right;
-
-                // cascade insertion if the slot is occupied
-                uint64_t prev_hash_index = num_hashes;
-                for (uint64_t i = 0; (x_r != invalid_data) && (i < threshold); i++)
+                return table_index * num_ranges + (bin(table_index, value, j) >> range_shift);
+            }
+        );
+
+        uint64_t bucket_threads = min(num_threads, num_buckets);
+        vector<vector<uint64_t>> deferred(bucket_threads);
+        vector<thread> threads(bucket_threads);
+        for (uint64_t t = 0; t < bucket_threads; t++)
+        {
+            threads[t] = thread
+            ([
+                this, t, j, bucket_threads, num_buckets, num_ranges, &bin, &sorted, &offsets, &deferred
+            ]()
+            {
+                for (uint64_t b = t; b < num_buckets; b += bucket_threads)
                 {
-                    uint64_t hash_index;
-                    do { hash_index = rand() % num_hashes; } // select a random hash function
-                    while (hash_index == prev_hash_index); // ensure that the same hash function is not selected twice
-                    prev_hash_index = hash_index;
-                    uint64_t bin_index = x_l ^ hashes[hash_index].hash(x_r); // index in the hash table given by x_l ^ H[i](x_r)
-                    // uint64_t mtx_index = bin_index & MUTEX_MASK;
-                    // mtx[mtx_index].lock();
-                    // while (locks[mtx_index].test_and_set(memory_order_acquire)) this_thread::yield();
-                    // while ((!locks[mtx_index]) && (locks[mtx_index] != u))
-                    // {
-                    //     if (!locks[mtx_index]) locks[mtx_index] = u;
-                    //     else this_thread::yield();
-                    // }
-                    swap(table_hashes[table_index][bin_index], prev_hash_index); // insert hash_index into the table
-                    swap(table_values[table_index][bin_index], x_r); // insert x_r into the table
-                    // mtx[mtx_index].unlock();
-                    // locks[mtx_index].clear(memory_order_release);
-                    // locks[mtx_index] = 0;
-
-                    if (x_r != invalid_data)
-                        x_l = bin_index ^ hashes[prev_hash_index].hash(x_r); // recover x_l
+                    uint64_t table_index = b / num_ranges;
+                    for (uint64_t e = offsets[b]; e < offsets[b+1]; e++)
+                    {
+                        uint64_t value = sorted[e];
+                        uint64_t slot_index = bin(table_index, value, j) * bin_width;
+                        uint64_t end = slot_index + bin_width;
+                        while ((slot_index < end) && ((getEntry(table_index, slot_index) >> hash_bits) != invalid_data)) slot_index++;
+                        if (slot_index < end) setEntry(table_index, slot_index, ((value & mask_right) << hash_bits) | j);
+                        else deferred[t].push_back(value);
+                    }
                 }
+            });
+        }
+        for (thread & t : threads) t.join();
 
-                if (x_r != invalid_data)
+        pending.clear();
+        for (const auto & d : deferred) pending.insert(pending.end(), d.begin(), d.end());
+    }
+
+    // the remaining values need evictions, which can reach any bin of their table, so all threads walk
+    // concurrently over the packed words, whose entries are only updated with compare-and-swap
+    fill(dirty_bins.begin(), dirty_bins.end(), true);
+    if (pending.empty()) return;
+
+    // eviction paths and counters assume no concurrent swaps, so the other strategies finish sequentially
+    // a table that fails stops taking values, but the other tables still get theirs
+    if (insertion != Insertion::random_walk)
+    {
+        vector<bool> failed(num_tables, false);
+        for (uint64_t value : pending)
+        {
+            uint64_t table_index = g.quickHash(value);
+            uint64_t leftover;
+            if (!failed[table_index] && !place(value, leftover)) failed[table_index] = true;
+        }
+        if (find(failed.begin(), failed.end(), true) != failed.end()) throw runtime_error("Cuckoo insertion failed");
+        return;
+    }
+
+    const uint64_t entries_per_word = 64 / entry_bits;
+    const uint64_t entry_mask = (entry_bits == 64) ? ~0ULL : (1ULL << entry_bits) - 1ULL;
+    const uint64_t hash_mask = (1ULL << hash_bits) - 1ULL;
+    const uint64_t empty = (invalid_data << hash_bits) | num_hashes;
+
+    // replace the entry of a slot if it equals 'expected' (any entry if 'any' is set) and return the previous entry
+    // the words of entries are aligned, so the walk swaps them in place with the atomic builtins
+    auto update = [this, entries_per_word, entry_mask](uint64_t table_index, uint64_t slot_index, uint64_t expected, bool any, uint64_t entry) -> uint64_t
+    {
+        uint64_t * word = &entries[table_index * table_words + slot_index / entries_per_word];
+        uint64_t shift = (slot_index % entries_per_word) * entry_bits;
+        uint64_t old_word = __atomic_load_n(word, __ATOMIC_RELAXED), old_entry;
+        do
+        {
+            old_entry = (old_word >> shift) & entry_mask;
+            if (!any && (old_entry != expected)) break;
+        } while (!__atomic_compare_exchange_n(word, &old_word, (old_word & ~(entry_mask << shift)) | (entry << shift), true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        return old_entry;
+    };
+
+    vector<atomic<bool>> failed(num_tables); // tables whose stash overflowed, the other tables carry on
+    atomic<uint64_t> walk_evictions(0);
+    mutex stash_mutex;
+
+    // the walk with the number of hash functions fixed at compile time for the common values, 0 handles any value
+    auto walk = [&](auto hashes)
+    {
+        constexpr uint64_t H = decltype(hashes)::value;
+        const uint64_t h = H ? H : num_hashes;
+        parallelFor(pending.size(), num_threads, [this, h, hash_mask, empty, &pending, &update, &failed, &walk_evictions, &stash_mutex](uint64_t, uint64_t j)
+        {
+            uint64_t value = pending[j];
+            uint64_t table_index = g.quickHash(value);
+            if (failed[table_index]) return;
+            uint64_t x_l = value >> size_right;
+            uint64_t x_r = value & mask_right;
+
+            bool placed = false;
+            uint64_t prev_hash_index = h;
+            for (uint64_t i = 0; !placed && (i < threshold); i++)
+            {
+                // claim an empty slot of a candidate bin if there is one
+                for (uint64_t hash_index = 0; !placed && (hash_index < h); hash_index++)
                 {
-                    failure[t] = true;
-                    return;
+                    if (hash_index == prev_hash_index) continue;
+                    uint64_t slot_index = (x_l ^ hashOf(table_index, hash_index).hash(x_r)) * bin_width;
+                    for (uint64_t w = 0; !placed && (w < bin_width); w++)
+                        placed = (update(table_index, slot_index + w, empty, false, (x_r << hash_bits) | hash_index) == empty);
                 }
+                if (placed) break;
+
+                // otherwise, swap with the occupant of a random slot of a random candidate bin and carry on with the evicted value
+                uint64_t hash_index;
+                do { hash_index = generator()() % h; } // select a random hash function
+                while (hash_index == prev_hash_index); // ensure that the same hash function is not selected twice
+                uint64_t bin_index = x_l ^ hashOf(table_index, hash_index).hash(x_r);
+                uint64_t slot_index = bin_index * bin_width + generator()() % bin_width;
+                uint64_t evicted = update(table_index, slot_index, 0, true, (x_r << hash_bits) | hash_index);
+                placed = (evicted == empty);
+
+                x_r = evicted >> hash_bits;
+                prev_hash_index = evicted & hash_mask;
+                if (placed) break;
+                x_l = bin_index ^ hashOf(table_index, prev_hash_index).hash(x_r); // recover x_l
+                walk_evictions.fetch_add(1, memory_order_relaxed);
             }
+
+            if (placed) return;
+
+            // keep the evicted value in the stash if there is room left
+            lock_guard<mutex> lock(stash_mutex);
+            if (stash.size() == stash_size) { failed[table_index] = true; return; }
+            stash.push_back((x_l << size_right) | x_r);
+            dirty_stash = true;
         });
+    };
+    switch (num_hashes)
+    {
+        case 2: walk(integral_constant<uint64_t, 2>()); break;
+        case 3: walk(integral_constant<uint64_t, 3>()); break;
+        case 4: walk(integral_constant<uint64_t, 4>()); break;
+        default: walk(integral_constant<uint64_t, 0>());
     }
-    for (thread & t : threads) t.join();
-    for (bool f : failure) 
+
+    evictions += walk_evictions;
+
+    for (const auto & f : failed)
         if (f) throw runtime_error("Cuckoo insertion failed");
 }
 
+// parameters (as in operator<<) followed by the packed words of the tables and the stash
+void Kuckoo::load(istream & is)
+{
+    hashes.clear();
+    is >> *this;
+
+    is >> num_tables >> table_size;
+    is.get(); // skip end of line
+
+    hash_bits = math::clog2(num_hashes + 1);
+    entry_bits = 1ULL << math::clog2(size_right + 1 + hash_bits);
+    uint64_t entries_per_word = 64 / entry_bits;
+    table_words = table_size / entries_per_word + bool(table_size % entries_per_word);
+    entries = vector<uint64_t, AlignedAllocator<uint64_t>>(num_tables * table_words);
+    is.read(reinterpret_cast<char *>(entries.data()), entries.size() * sizeof(uint64_t));
+    uint64_t num_stashed;
+    is.read(reinterpret_cast<char *>(&num_stashed), sizeof(uint64_t));
+    stash = vector<uint64_t>(num_stashed);
+    is.read(reinterpret_cast<char *>(stash.data()), num_stashed * sizeof(uint64_t));
+    if (!is) throw runtime_error("Could not load Cuckoo hash table");
+
+    dirty_bins = vector<bool>(table_size, false);
+    dirty_stash = false;
+}
+
+void Kuckoo::save(ostream & os) const
+{
+    os << *this;
+    os << num_tables << ' ' << table_size << '\n';
+    os.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(uint64_t));
+    uint64_t num_stashed = stash.size();
+    os.write(reinterpret_cast<const char *>(&num_stashed), sizeof(uint64_t));
+    os.write(reinterpret_cast<const char *>(stash.data()), num_stashed * sizeof(uint64_t));
+}
+
+uint64_t Kuckoo::getEntry(uint64_t table_index, uint64_t slot_index) const
+{
+    uint64_t entries_per_word = 64 / entry_bits;
+    uint64_t word = entries[table_index * table_words + slot_index / entries_per_word];
+    uint64_t entry = word >> ((slot_index % entries_per_word) * entry_bits);
+    return (entry_bits == 64) ? entry : entry & ((1ULL << entry_bits) - 1ULL);
+}
+
+void Kuckoo::setEntry(uint64_t table_index, uint64_t slot_index, uint64_t entry)
+{
+    uint64_t entries_per_word = 64 / entry_bits;
+    uint64_t & word = entries[table_index * table_words + slot_index / entries_per_word];
+    uint64_t shift = (slot_index % entries_per_word) * entry_bits;
+    uint64_t mask = (entry_bits == 64) ? ~0ULL : ((1ULL << entry_bits) - 1ULL) << shift;
+    word = (word & ~mask) | (entry << shift);
+}
+
+// the values held by a table and by the stash for it
+vector<uint64_t> Kuckoo::tableValues(uint64_t table_index) const
+{
+    vector<uint64_t> values;
+    const uint64_t hash_mask = (1ULL << hash_bits) - 1ULL;
+    for (uint64_t slot_index = 0; slot_index < table_size; slot_index++)
+    {
+        uint64_t entry = getEntry(table_index, slot_index);
+        uint64_t x_r = entry >> hash_bits;
+        if (x_r == invalid_data) continue;
+        uint64_t x_l = (slot_index / bin_width) ^ hashOf(table_index, entry & hash_mask).hash(x_r);
+        values.push_back((x_l << size_right) | x_r);
+    }
+    for (uint64_t value : stash)
+        if (g.quickHash(value) == table_index) values.push_back(value);
+    return values;
+}
+
+// empty a table (and the stash of its values) and give it new hash functions
+void Kuckoo::rehash(uint64_t table_index)
+{
+    const uint64_t num_bins = table_size / bin_width;
+    if (hashes.size() == num_hashes)
+    {
+        vector<Hash> shared(hashes);
+        for (uint64_t l = 1; l < num_tables; l++) hashes.insert(hashes.end(), shared.begin(), shared.end());
+    }
+    auto fresh = randomHashes(num_hashes, num_bins, max_data);
+    copy(fresh.begin(), fresh.end(), hashes.begin() + table_index * num_hashes);
+
+    for (uint64_t slot_index = 0; slot_index < table_size; slot_index++)
+        setEntry(table_index, slot_index, (invalid_data << hash_bits) | num_hashes);
+    auto stashed = remove_if(stash.begin(), stash.end(), [this, table_index](uint64_t value) { return g.quickHash(value) == table_index; });
+    dirty_stash |= (stashed != stash.end());
+    stash.erase(stashed, stash.end());
+    if (!bin_evictions.empty()) fill(bin_evictions.begin() + table_index * num_bins, bin_evictions.begin() + (table_index+1) * num_bins, 0);
+    fill(dirty_bins.begin(), dirty_bins.end(), true);
+    rehashes++;
+}
+
+void Kuckoo::setInsertion(Insertion insertion)
+{
+    this->insertion = insertion;
+    if (insertion == Insertion::min_counter) bin_evictions.assign(num_tables * (table_size / bin_width), 0);
+}
+
+// breadth-first search over the slots of the candidate bins of x, then over the other candidate bins of their
+// occupants, and so on, for the shortest path of evictions that ends in an empty slot
+// the search visits at most 'threshold' slots; returns false (and changes nothing) if no path was found
+template <uint64_t H>
+bool Kuckoo::insertPath(uint64_t table_index, uint64_t x_l, uint64_t x_r)
+{
+    const uint64_t h = H ? H : num_hashes;
+
+    // most insertions find an empty slot right away
+    for (uint64_t hash_index = 0; hash_index < h; hash_index++)
+    {
+        uint64_t first = (x_l ^ hashOf(table_index, hash_index).hash(x_r)) * bin_width;
+        for (uint64_t slot_index = first; slot_index < first + bin_width; slot_index++)
+        {
+            if ((getEntry(table_index, slot_index) >> hash_bits) != invalid_data) continue;
+            setEntry(table_index, slot_index, (x_r << hash_bits) | hash_index);
+            dirty_bins[slot_index] = true;
+            return true;
+        }
+    }
+
+    struct Node
+    {
+        uint64_t slot_index;
+        uint64_t hash_index; // hash function that maps the element moving into this slot here
+        uint64_t parent;     // node whose occupant moves into this slot
+    };
+    const uint64_t root = ~0ULL;
+    const uint64_t hash_mask = (1ULL << hash_bits) - 1ULL;
+
+    // the tree may reach a slot through different paths, but a path never goes through a slot twice
+    thread_local vector<Node> nodes;
+    nodes.clear();
+    auto onPath = [](uint64_t slot_index, uint64_t n)
+    {
+        for (; n != root; n = nodes[n].parent) if (nodes[n].slot_index == slot_index) return true;
+        return false;
+    };
+    auto expand = [this, table_index, h, &onPath](uint64_t x_l, uint64_t x_r, uint64_t skip_hash_index, uint64_t parent)
+    {
+        for (uint64_t hash_index = 0; hash_index < h; hash_index++)
+        {
+            if (hash_index == skip_hash_index) continue;
+            uint64_t first = (x_l ^ hashOf(table_index, hash_index).hash(x_r)) * bin_width;
+            for (uint64_t slot_index = first; slot_index < first + bin_width; slot_index++)
+                if (!onPath(slot_index, parent)) nodes.push_back({slot_index, hash_index, parent});
+        }
+    };
+    expand(x_l, x_r, h, root);
+
+    for (uint64_t n = 0; n < nodes.size(); n++)
+    {
+        uint64_t entry = getEntry(table_index, nodes[n].slot_index);
+        uint64_t y_r = entry >> hash_bits;
+        if (y_r != invalid_data)
+        {
+            // the occupant may move to any of its other candidate bins
+            if (nodes.size() >= threshold) continue;
+            uint64_t y_hash_index = entry & hash_mask;
+            uint64_t y_l = (nodes[n].slot_index / bin_width) ^ hashOf(table_index, y_hash_index).hash(y_r);
+            expand(y_l, y_r, y_hash_index, n);
+            continue;
+        }
+
+        // shift the occupants along the path, starting from the empty slot
+        for (; nodes[n].parent != root; n = nodes[n].parent)
+        {
+            uint64_t moved = getEntry(table_index, nodes[nodes[n].parent].slot_index) >> hash_bits;
+            setEntry(table_index, nodes[n].slot_index, (moved << hash_bits) | nodes[n].hash_index);
+            dirty_bins[nodes[n].slot_index] = true;
+            evictions++;
+        }
+        setEntry(table_index, nodes[n].slot_index, (x_r << hash_bits) | nodes[n].hash_index);
+        dirty_bins[nodes[n].slot_index] = true;
+        return true;
+    }
+    return false;
+}
+
+// hash function (other than prev_hash_index) whose bin has had the fewest evictions, ties broken at random
+// the count of the selected bin is incremented
+template <uint64_t H>
+uint64_t Kuckoo::leastEvicted(uint64_t table_index, uint64_t x_l, uint64_t x_r, uint64_t prev_hash_index)
+{
+    const uint64_t h = H ? H : num_hashes;
+    const uint64_t num_bins = table_size / bin_width;
+    uint64_t start = generator()() % h;
+    uint64_t best = h, best_count = 0;
+    for (uint64_t i = 0; i < h; i++)
+    {
+        uint64_t hash_index = (start + i) % h;
+        if (hash_index == prev_hash_index) continue;
+        uint64_t count = bin_evictions[table_index * num_bins + (x_l ^ hashOf(table_index, hash_index).hash(x_r))];
+        if ((best == h) || (count < best_count)) { best = hash_index; best_count = count; }
+    }
+    auto & count = bin_evictions[table_index * num_bins + (x_l ^ hashOf(table_index, best).hash(x_r))];
+    if (count < UINT32_MAX) count++;
+    return best;
+}
+
+// first empty slot of a bin, or a random slot if the bin is full
+uint64_t Kuckoo::freeSlot(uint64_t table_index, uint64_t bin_index) const
+{
+    uint64_t first = bin_index * bin_width;
+    for (uint64_t slot_index = first; slot_index < first + bin_width; slot_index++)
+        if ((getEntry(table_index, slot_index) >> hash_bits) == invalid_data) return slot_index;
+    return first + generator()() % bin_width;
+}
+
+// find the table and slot where value is stored
+bool Kuckoo::locate(uint64_t value, uint64_t & table_index, uint64_t & slot_index) const
+{
+    switch (num_hashes)
+    {
+        case 2: return locateKernel<2>(value, table_index, slot_index);
+        case 3: return locateKernel<3>(value, table_index, slot_index);
+        case 4: return locateKernel<4>(value, table_index, slot_index);
+        default: return locateKernel<0>(value, table_index, slot_index);
+    }
+}
+
+template <uint64_t H>
+bool Kuckoo::locateKernel(uint64_t value, uint64_t & table_index, uint64_t & slot_index) const
+{
+    table_index = g.quickHash(value);
+    uint64_t x_l = value >> size_right;
+    uint64_t x_r = value & mask_right;
+
+    // x_l ^ H[i](x_r) and the hash index recorded in the slot uniquely identify x_l
+    for (uint64_t i = 0; i < (H ? H : num_hashes); i++)
+    {
+        uint64_t first = (x_l ^ hashOf(table_index, i).hash(x_r)) * bin_width;
+        for (slot_index = first; slot_index < first + bin_width; slot_index++)
+            if (getEntry(table_index, slot_index) == ((x_r << hash_bits) | i))
+                return true;
+    }
+    return false;
+}
+
 istream & operator>>(istream & is, Kuckoo & cuckoo)
 {
-    is >> cuckoo.max_data;
-    is >> cuckoo.invalid_data;
-    is >> cuckoo.num_hashes;
-    is >> cuckoo.threshold;
-    is >> cuckoo.size_right;
-    is >> cuckoo.mask_right;
+    // the number of hash function sets is only written when tables were rehashed separately
+    string line;
+    is >> ws;
+    getline(is, line);
+    istringstream iss(line);
+    uint64_t num_hash_sets = 1;
+    iss >> cuckoo.max_data;
+    iss >> cuckoo.invalid_data;
+    iss >> cuckoo.num_hashes;
+    iss >> cuckoo.threshold;
+    iss >> cuckoo.size_right;
+    iss >> cuckoo.mask_right;
+    iss >> cuckoo.size_left;
+    iss >> cuckoo.stash_size;
+    iss >> cuckoo.bin_width;
+    iss >> num_hash_sets;
     is >> cuckoo.g;
-    for (uint64_t i=0; i<cuckoo.num_hashes; i++)
+    for (uint64_t i=0; i<num_hash_sets*cuckoo.num_hashes; i++)
     {
         Hash hash;
         is >> hash;
@@ -253,7 +926,12 @@ ostream & operator<<(ostream & os, const Kuckoo & cuckoo)
     os << cuckoo.num_hashes << ' ';
     os << cuckoo.threshold << ' ';
     os << cuckoo.size_right << ' ';
-    os << cuckoo.mask_right << '\n';
+    os << cuckoo.mask_right << ' ';
+    os << cuckoo.size_left << ' ';
+    os << cuckoo.stash_size << ' ';
+    os << cuckoo.bin_width;
+    if (cuckoo.hashes.size() > cuckoo.num_hashes) os << ' ' << cuckoo.hashes.size() / cuckoo.num_hashes;
+    os << '\n';
     os << cuckoo.g << '\n';
     for (const Hash & hash : cuckoo.hashes) os << hash << '\n';
     return os;
@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <cstdint>
+#include <new>
 #include <vector>
 #include <tuple>
 #include "hash.h"
@@ -11,35 +12,112 @@
 namespace cuckoo
 {
 
+// allocator for cache-line aligned buffers
+template <class T, std::size_t Alignment = 64>
+struct AlignedAllocator
+{
+    using value_type = T;
+    template <class U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T * allocate(std::size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T * p, std::size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <class U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <class U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+// how an element that finds its candidate bins full makes room
+// random_walk: evict from a random candidate bin and carry on with the evicted element
+// bfs: breadth-first search (up to 'threshold' slots) for the shortest eviction path to an empty slot, then random walk
+// min_counter: random walk that evicts from the candidate bin with the fewest evictions so far
+enum class Insertion { random_walk, bfs, min_counter };
+
 using KuckooIndices = std::tuple<uint64_t, uint64_t, std::vector<uint64_t>>;
-using KuckooParameters = std::tuple<Hash, std::vector<Hash>, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
+using KuckooParameters = std::tuple<Hash, std::vector<Hash>, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>;
 
 class Kuckoo
 {
     private:
         Hash g;
-        std::vector<Hash> hashes;
-        std::vector<std::vector<uint64_t>> table_hashes;
-        std::vector<std::vector<uint64_t>> table_values;
+        std::vector<Hash> hashes; // num_hashes functions shared by all tables, or num_hashes per table once rehashed
+        // one (x_r << hash_bits | hash index) entry per slot, bit-packed into 64-bit words
+        // tables are stored one after the other, each starting at a word boundary
+        std::vector<uint64_t, AlignedAllocator<uint64_t>> entries;
+        uint64_t num_tables = 0;
+        uint64_t table_size = 0;
+        uint64_t table_words = 0;
+        uint64_t entry_bits = 0; // a power of two, so entries never straddle words
+        uint64_t hash_bits = 0;
+        std::vector<bool> dirty_bins;
+        std::vector<uint64_t> stash; // full values that could not be placed within threshold evictions
+        bool dirty_stash = false;
         uint64_t max_data;
         uint64_t invalid_data;
         uint64_t num_hashes;
         uint64_t threshold;
         uint64_t size_right;
         uint64_t mask_right;
+        uint64_t size_left;
+        uint64_t stash_size;
+        uint64_t bin_width; // slots per bin
+        Insertion insertion = Insertion::random_walk;
+        uint64_t evictions = 0; // elements moved out of their slot by insertions
+        std::vector<uint32_t> bin_evictions; // per bin of every table, for min_counter
+        uint64_t rehashes = 0; // tables rebuilt with new hash functions after a failed insertion
+
+        uint64_t getEntry(uint64_t table_index, uint64_t slot_index) const;
+        void setEntry(uint64_t table_index, uint64_t slot_index, uint64_t entry);
+        uint64_t freeSlot(uint64_t table_index, uint64_t bin_index) const;
+        const Hash & hashOf(uint64_t table_index, uint64_t hash_index) const;
+        void rehash(uint64_t table_index);
+        std::vector<uint64_t> tableValues(uint64_t table_index) const;
+        bool place(uint64_t value, uint64_t & leftover);
+        bool locate(uint64_t value, uint64_t & table_index, uint64_t & slot_index) const;
+
+        // kernels with H = num_hashes or K = num_tables fixed at compile time, 0 handles any value
+        template <uint64_t H> void indicesKernel(const uint64_t * values, uint64_t count, uint64_t * x_r, uint64_t * table_indices, uint64_t * indices) const;
+        template <uint64_t H> bool locateKernel(uint64_t value, uint64_t & table_index, uint64_t & slot_index) const;
+        template <uint64_t K> void slotsKernel(uint64_t offset, uint64_t count, std::vector<uint64_t> & vs) const;
+        template <uint64_t H> bool insertKernel(uint64_t value, uint64_t & leftover);
+        template <uint64_t H> bool insertPath(uint64_t table_index, uint64_t x_l, uint64_t x_r);
+        template <uint64_t H> uint64_t leastEvicted(uint64_t table_index, uint64_t x_l, uint64_t x_r, uint64_t prev_hash_index);
 
     public:
-        Kuckoo(){}
-        Kuckoo(uint64_t num_hashes, uint64_t table_size, uint64_t max_data, uint64_t threshold, uint64_t num_tables = 1);
+        Kuckoo(){} // empty until read by operator>> or load; only load restores the tables themselves
+        Kuckoo(uint64_t num_hashes, uint64_t table_size, uint64_t max_data, uint64_t threshold, uint64_t num_tables = 1, uint64_t stash_size = 0, uint64_t bin_width = 1);
         Kuckoo(const KuckooParameters & params);
 
+        void clearDirtyBins();
+        bool contains(uint64_t value) const;
+        bool erase(uint64_t value);
+        std::vector<uint64_t> getDirtyBins() const;
+        bool getDirtyStash() const;
+        uint64_t getBinWidth() const;
+        uint64_t getEvictions() const;
         KuckooIndices getIndices(uint64_t value) const;
+        Insertion getInsertion() const;
+        // batched getIndices: indices[j * count + i] is the first slot of the j-th bin of values[i]
+        void getIndices(const uint64_t * values, uint64_t count, uint64_t * x_r, uint64_t * table_indices, uint64_t * indices) const;
         uint64_t getNumHashes() const;
+        uint64_t getNumTables() const;
         KuckooParameters getParameters() const;
-        const std::vector<std::vector<uint64_t>> & getTable() const;
+        uint64_t getRehashes() const;
+        const std::vector<uint64_t> & getStash() const;
+        uint64_t getStashSize() const;
+        void getSlots(uint64_t offset, std::vector<uint64_t> & vs) const;
+        uint64_t getTableSize() const;
+        uint64_t getValueSize() const;
         void insert(uint64_t value);
+        void insert(uint64_t value, uint64_t num_threads, uint64_t max_rehashes);
         void insert(const std::vector<uint64_t> & set);
         void insert(const std::vector<uint64_t> & set, uint64_t num_threads);
+        void insert(const std::vector<uint64_t> & set, uint64_t num_threads, uint64_t max_rehashes);
+        void load(std::istream & is);
+        void save(std::ostream & os) const;
+        void setInsertion(Insertion insertion);
 
         friend std::istream & operator>>(std::istream & is, Kuckoo & cuckoo);
         friend std::ostream & operator<<(std::ostream & os, const Kuckoo & cuckoo);
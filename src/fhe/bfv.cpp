@@ -3,6 +3,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <stdexcept>
+#include <string>
 #include <tuple>
 #include <vector>
 #include "seal/seal.h"
@@ -50,6 +51,14 @@ SEALContext * instantiateEncryptionScheme(uint64_t n, const std::vector<int> & l
     return context_ptr;
 }
 
+parms_id_type levelOfPrimes(const SEALContext * context_ptr, uint64_t num_primes)
+{
+    if (!num_primes) return context_ptr->first_parms_id();
+    for (auto data = context_ptr->first_context_data(); data; data = data->next_context_data())
+        if (data->parms().coeff_modulus().size() == num_primes) return data->parms_id();
+    throw "No level with " + to_string(num_primes) + " primes";
+}
+
 void rotate(Ciphertext & ct, uint64_t steps, uint64_t n, const Evaluator * evaluator_ptr, const GaloisKeys * galoiskeys_ptr)
 {
     n >>= 1; // n = n/2
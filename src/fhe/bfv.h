@@ -17,6 +17,9 @@ KeysTuple generateKeys(const seal::SEALContext * context_ptr, bool galois = true
 
 seal::SEALContext * instantiateEncryptionScheme(uint64_t n, const std::vector<int> & logqi, const std::vector<uint64_t> & ti);
 
+// level of the modulus chain with 'num_primes' primes in the coefficient modulus; 0 stands for the first data level
+seal::parms_id_type levelOfPrimes(const seal::SEALContext * context_ptr, uint64_t num_primes);
+
 void rotate(seal::Ciphertext & ct, uint64_t steps, uint64_t n, const seal::Evaluator * evaluator_ptr, const seal::GaloisKeys * galoiskeys_ptr);
 
 bool validKeys(const seal::SEALContext * context_ptr);
@@ -1,18 +1,43 @@
 #include "packing.h"
 
 #include <cstdint>
-#include <thread>
 #include <vector>
 #include "crt.h"
+#include "executor.h"
+#include "math.h"
 #include "seal/seal.h"
 
 using namespace math;
+using namespace parallel;
 using namespace seal;
 using namespace std;
 
 namespace fhe
 {
-    
+
+// vs[j*k+l] = vvs[l][offset+j] for the first m slots
+// K > 0 fixes the number of CRT components k at compile time, K = 0 handles any k
+template <uint64_t K>
+static void interleave(vector<uint64_t> & vs, const vector<vector<uint64_t>> & vvs, uint64_t offset, uint64_t m)
+{
+    const uint64_t k = K ? K : vvs.size();
+    for (uint64_t j=0; j<m; j++)
+    {
+        for (uint64_t l=0; l<k; l++)
+            vs[j*k+l] = vvs[l][offset+j];
+    }
+}
+
+static void interleave(vector<uint64_t> & vs, const vector<vector<uint64_t>> & vvs, uint64_t offset, uint64_t m)
+{
+    switch (vvs.size())
+    {
+        case 1: interleave<1>(vs, vvs, offset, m); break;
+        case 2: interleave<2>(vs, vvs, offset, m); break;
+        default: interleave<0>(vs, vvs, offset, m);
+    }
+}
+
 vector<uint64_t> packDecode(const Plaintext & pt, const CrtParams & crt, const BatchEncoder * encoder_ptr)
 {
     vector<uint64_t> vpack;
@@ -27,12 +52,92 @@ vector<uint64_t> packDecrypt(const Ciphertext & ct, const CrtParams & crt, const
     return packDecode(pt, crt, encoder_ptr);
 }
 
+void packDecryptSlots(const Ciphertext & ct, Plaintext & pt, vector<uint64_t> & vpack, const BatchEncoder * encoder_ptr, Decryptor * decryptor_ptr)
+{
+    decryptor_ptr->decrypt(ct, pt);
+    encoder_ptr->decode(pt, vpack);
+}
+
 void packEncode(Plaintext & pt, const vector<uint64_t> & vs, const CrtParams & crt, const BatchEncoder * encoder_ptr)
 {
     auto vpack = crtEncode(vs, crt);
     encoder_ptr->encode(vpack, pt);
 }
 
+QueryEncoder::QueryEncoder(const CrtParams & crt, const BatchEncoder * encoder_ptr, uint64_t fill)
+{
+    this->n = encoder_ptr->slot_count();
+    this->t = crt.M;
+    this->crt_ptr = &crt;
+    this->fill = fill;
+
+    packEncode(fill_pt, vector<uint64_t>(crt.mi.size() * n, fill), crt, encoder_ptr);
+
+    Plaintext unit_pt;
+    vector<uint64_t> e0(n, 0);
+    e0[0] = 1;
+    encoder_ptr->encode(e0, unit_pt);
+    unit.assign(unit_pt.data(), unit_pt.data() + unit_pt.coeff_count());
+    unit.resize(n, 0);
+
+    // slot i of the first row is evaluated at psi^(3^i), and slot i of the second row at psi^(-3^i),
+    // so g is the inverse of that exponent modulo 2n
+    const uint64_t m = 2 * n;
+    const uint64_t row_size = n / 2;
+    const uint64_t inverse3 = math::modinv(3, m);
+    galois.resize(n);
+    for (uint64_t i = 0, g = 1; i < row_size; i++, g = (g * inverse3) % m)
+    {
+        galois[i] = g;
+        galois[row_size + i] = m - g;
+    }
+}
+
+void QueryEncoder::encode(Plaintext & pt, uint64_t first_slot, uint64_t num_slots, uint64_t component, uint64_t value) const
+{
+    pt = fill_pt;
+    pt.resize(n);
+    addOffset(pt, first_slot, num_slots, component, value);
+}
+
+void QueryEncoder::encodeOffset(Plaintext & pt, uint64_t first_slot, uint64_t num_slots, uint64_t component, uint64_t value) const
+{
+    pt.resize(n);
+    pt.set_zero();
+    addOffset(pt, first_slot, num_slots, component, value);
+}
+
+void QueryEncoder::addOffset(Plaintext & pt, uint64_t first_slot, uint64_t num_slots, uint64_t component, uint64_t value) const
+{
+    using u128 = unsigned __int128;
+    auto coeffs = pt.data();
+
+    // changing one CRT component of a slot from fill to value changes the packed value by delta
+    const auto & crt = *crt_ptr;
+    uint64_t mi = crt.mi[component];
+    uint64_t diff = (value % mi + mi - fill % mi) % mi;
+    uint64_t delta = uint64_t(u128(diff) * crt.MiiMi[component] % t);
+    if (!delta) return;
+    uint64_t delta_shoup = uint64_t((u128(delta) << 64) / t); // multiplications by delta without division
+
+    const uint64_t m = 2 * n;
+    for (uint64_t s = first_slot; s < first_slot + num_slots; s++)
+    {
+        uint64_t g = galois[s];
+        for (uint64_t i = 0, j = 0; i < n; i++, j = (j + g) & (m - 1))
+        {
+            uint64_t c = unit[i];
+            uint64_t q = uint64_t((u128(c) * delta_shoup) >> 64);
+            uint64_t d = c * delta - q * t;
+            if (d >= t) d -= t;
+            // x^j with j >= n wraps around to -x^(j-n)
+            uint64_t & coeff = coeffs[j < n ? j : j - n];
+            if (j < n) coeff = (coeff + d >= t) ? coeff + d - t : coeff + d;
+            else coeff = (coeff >= d) ? coeff - d : coeff + t - d;
+        }
+    }
+}
+
 void packEncrypt(Ciphertext & ct, const vector<uint64_t> & vs, const CrtParams & crt, const BatchEncoder * encoder_ptr, const Encryptor * encryptor_ptr)
 {
     Plaintext pt;
@@ -53,12 +158,7 @@ void packEncrypt(std::vector<seal::Ciphertext> & vct, const vector<vector<uint64
     {
         vector<uint64_t> vs(k * n);
         uint64_t offset = i*n;
-        uint64_t m = min(n, size_vs-offset);
-        for (uint64_t j=0; j<m; j++)
-        {
-            for (uint64_t l=0; l<k; l++)
-                vs[j*k+l] = vvs[l][offset+j];
-        }
+        interleave(vs, vvs, offset, min(n, size_vs-offset));
         packEncrypt(vct[i], vs, crt, encoder_ptr, encryptor_ptr);
     }
 }
@@ -72,28 +172,13 @@ void packEncrypt(std::vector<seal::Ciphertext> & vct, const vector<vector<uint64
     uint64_t size_vs = vvs[0].size();
     uint64_t size_vct = size_vs / n + bool(size_vs % n);
     vct.resize(size_vct);
-    num_threads = min(num_threads, size_vct);
-    vector<thread> threads(num_threads);
-    for (uint64_t t=0; t<num_threads; t++)
+    executor(num_threads).parallelFor(size_vct, [&vct, &vvs, &crt, encoder_ptr, encryptor_ptr, n, size_vs, k](uint64_t i)
     {
-        threads[t] = thread([t, num_threads, &vct, &vvs, &crt, encoder_ptr, encryptor_ptr, n, size_vs, size_vct, k]()
-        {
-            uint64_t kn = k * n;
-            for (uint64_t i=t; i<size_vct; i+=num_threads)
-            {
-                vector<uint64_t> vs(kn);
-                uint64_t offset = i*n;
-                uint64_t m = min(n, size_vs-offset);
-                for (uint64_t j=0; j<m; j++)
-                {
-                    for (uint64_t l=0; l<k; l++)
-                        vs[j*k+l] = vvs[l][offset+j];
-                }
-                packEncrypt(vct[i], vs, crt, encoder_ptr, encryptor_ptr);
-            }
-        });
-    }
-    for (auto & thread : threads) thread.join();
+        vector<uint64_t> vs(k * n);
+        uint64_t offset = i*n;
+        interleave(vs, vvs, offset, min(n, size_vs-offset));
+        packEncrypt(vct[i], vs, crt, encoder_ptr, encryptor_ptr);
+    });
 }
 
 } // fhe
\ No newline at end of file
@@ -8,8 +8,42 @@
 namespace fhe
 {
 
+// encodes plaintexts that hold 'fill' in every CRT component of every slot except for a run of slots,
+// without a full encode: batching is linear, so such a plaintext is the encoded all-'fill' plaintext plus
+// a multiple of the unit plaintext of each changed slot, and the unit plaintext of slot s is the one of
+// slot 0 under the Galois automorphism x -> x^g that maps the evaluation point of slot s to that of slot 0
+class QueryEncoder
+{
+    private:
+        uint64_t n;
+        uint64_t t;
+        const math::CrtParams * crt_ptr;
+        uint64_t fill;
+        seal::Plaintext fill_pt;
+        std::vector<uint64_t> unit; // coefficients of the unit plaintext of slot 0
+        std::vector<uint64_t> galois; // g of each slot
+
+    public:
+        QueryEncoder(const math::CrtParams & crt, const seal::BatchEncoder * encoder_ptr, uint64_t fill);
+
+        // slots [first_slot, first_slot + num_slots) hold 'value' in CRT component 'component'
+        void encode(seal::Plaintext & pt, uint64_t first_slot, uint64_t num_slots, uint64_t component, uint64_t value) const;
+
+        // same as 'encode' minus the all-'fill' plaintext, for ciphertexts that already had it subtracted
+        void encodeOffset(seal::Plaintext & pt, uint64_t first_slot, uint64_t num_slots, uint64_t component, uint64_t value) const;
+
+        // adds the difference between the plaintext of 'encode' and the all-'fill' plaintext to pt (of n coefficients),
+        // so several runs of slots can go into one plaintext
+        void addOffset(seal::Plaintext & pt, uint64_t first_slot, uint64_t num_slots, uint64_t component, uint64_t value) const;
+
+        const seal::Plaintext & fillPlaintext() const { return fill_pt; }
+};
+
 std::vector<uint64_t> packDecode(const seal::Plaintext & pt, const math::CrtParams & crt, const seal::BatchEncoder * encoder_ptr);
 
+// decrypts and batch-decodes ct into the packed slot values, without the CRT decode, reusing the caller's buffers
+void packDecryptSlots(const seal::Ciphertext & ct, seal::Plaintext & pt, std::vector<uint64_t> & vpack, const seal::BatchEncoder * encoder_ptr, seal::Decryptor * decryptor_ptr);
+
 std::vector<uint64_t> packDecrypt(const seal::Ciphertext & ct, const math::CrtParams & crt, const seal::BatchEncoder * encoder_ptr, seal::Decryptor * decryptor_ptr);
 
 void packEncode(seal::Plaintext & pt, const std::vector<uint64_t> & vs, const math::CrtParams & crt, const seal::BatchEncoder * encoder_ptr);
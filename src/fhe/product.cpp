@@ -0,0 +1,185 @@
+#include "product.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "random.h"
+#include "seal/seal.h"
+
+using namespace math;
+using namespace seal;
+using namespace std;
+
+namespace fhe
+{
+
+Product parseProduct(const string & name)
+{
+    if (name == "multiply_many") return Product::multiply_many;
+    if (name == "tree") return Product::tree;
+    if (name == "lazy") return Product::lazy;
+    throw "Unknown product '" + name + "'";
+}
+
+string productName(Product product)
+{
+    switch (product)
+    {
+        case Product::multiply_many: return "multiply_many";
+        case Product::tree: return "tree";
+        case Product::lazy: return "lazy";
+    }
+    return "";
+}
+
+void multiplyTree
+(
+    const vector<Ciphertext> & operands,
+    Ciphertext & product,
+    const ProductPlan & plan,
+    const Evaluator * evaluator_ptr,
+    const RelinKeys * relinkeys_ptr
+)
+{
+    if (operands.empty()) throw "No operands to multiply";
+    if (plan.method == Product::multiply_many)
+    {
+        evaluator_ptr->multiply_many(operands, *relinkeys_ptr, product);
+        return;
+    }
+
+    // pairs of each level are multiplied into the next one, and an odd one out moves up as is
+    vector<Ciphertext> level = operands, next;
+    for (uint64_t d=0; ; d++)
+    {
+        if (d < plan.levels.size())
+            for (auto & ct : level)
+                if (ct.parms_id() != plan.levels[d]) evaluator_ptr->mod_switch_to_inplace(ct, plan.levels[d]);
+        if (level.size() == 1) break;
+
+        next.resize(level.size() / 2 + level.size() % 2);
+        for (uint64_t i=0; i+1<level.size(); i+=2)
+        {
+            evaluator_ptr->multiply(level[i], level[i+1], next[i/2]);
+            // only size-3 ciphertexts can be relinearized, so only the root may stay unrelinearized
+            if (plan.method != Product::lazy || next.size() > 1) evaluator_ptr->relinearize_inplace(next[i/2], *relinkeys_ptr);
+        }
+        if (level.size() % 2) next.back() = move(level.back());
+        swap(level, next);
+    }
+    product = move(level[0]);
+}
+
+static vector<parms_id_type> planLevels
+(
+    const SEALContext * context_ptr,
+    uint64_t num_operands,
+    Product method,
+    bool masked,
+    const parms_id_type & operand_level
+)
+{
+    const auto & context = *context_ptr;
+    uint64_t depth = 0;
+    while ((1ULL << depth) < num_operands) depth++;
+
+    // the data levels, from the operands' one down to the last
+    vector<parms_id_type> chain;
+    for (auto data = context.get_context_data(operand_level); data; data = data->next_context_data()) chain.push_back(data->parms_id());
+
+    // trial operands and mask under a throwaway key
+    KeyGenerator keygen(context);
+    RelinKeys relinkeys;
+    keygen.create_relin_keys(relinkeys);
+    Encryptor encryptor(context, keygen.secret_key());
+    Decryptor decryptor(context, keygen.secret_key());
+    Evaluator evaluator(context);
+    BatchEncoder encoder(context);
+    const uint64_t n = encoder.slot_count();
+    const uint64_t t = context.first_context_data()->parms().plain_modulus().value();
+    vector<Ciphertext> operands(max<uint64_t>(num_operands, 1));
+    for (auto & ct : operands)
+    {
+        Plaintext pt;
+        encoder.encode(randomVector(n, 0, t-1), pt);
+        encryptor.encrypt_symmetric(pt, ct);
+        if (ct.parms_id() != operand_level) evaluator.mod_switch_to_inplace(ct, operand_level);
+    }
+    Plaintext mask_pt;
+    encoder.encode(randomVector(n, 1, t-1), mask_pt);
+
+    // index[d] is the position in the chain of tree level d, never above the previous one
+    vector<uint64_t> index(depth + 1, 0);
+    auto budget = [&]()
+    {
+        ProductPlan plan { method, {} };
+        for (auto i : index) plan.levels.push_back(chain[i]);
+        Ciphertext product;
+        multiplyTree(operands, product, plan, &evaluator, &relinkeys);
+        if (masked) evaluator.multiply_plain_inplace(product, mask_pt);
+        evaluator.mod_switch_to_inplace(product, context.last_parms_id());
+        relinearizeProduct(product, &evaluator, &relinkeys);
+        return decryptor.invariant_noise_budget(product);
+    };
+
+    // lower each tree level, from the operands up, while the result loses at most 'noise_slack' bits (the spread between
+    // trials) of the budget it has without any lowering; the budget only shrinks along the way, so every stage is safe too
+    const int noise_slack = 1;
+    const int threshold = max(1, budget() - noise_slack);
+    for (uint64_t d=0; d<=depth; d++)
+    {
+        while (index[d] + 1 < chain.size())
+        {
+            auto saved = index;
+            uint64_t target = index[d] + 1;
+            for (uint64_t e=d; e<=depth; e++) index[e] = max(index[e], target);
+            if (budget() >= threshold) continue;
+            index = saved;
+            break;
+        }
+    }
+
+    vector<parms_id_type> levels;
+    for (auto i : index) levels.push_back(chain[i]);
+    return levels;
+}
+
+ProductPlan planProduct
+(
+    const SEALContext * context_ptr,
+    uint64_t num_operands,
+    Product method,
+    bool level_aware,
+    bool masked,
+    const parms_id_type & operand_level
+)
+{
+    ProductPlan plan { method, {} };
+    if (level_aware && method != Product::multiply_many) plan.levels = planLevels(context_ptr, num_operands, method, masked, operand_level);
+    return plan;
+}
+
+parms_id_type planOperandLevel(const SEALContext * context_ptr, uint64_t num_operands, Product method)
+{
+    // multiply_many is a tree too, and the first greedy step lowers every tree level with the operands
+    if (method == Product::multiply_many) method = Product::tree;
+    return planLevels(context_ptr, num_operands, method, false, context_ptr->first_parms_id())[0];
+}
+
+string levelsName(const ProductPlan & plan, const SEALContext * context_ptr)
+{
+    if (plan.levels.empty()) return "operands' level";
+    string name;
+    for (const auto & level : plan.levels)
+        name += (name.empty() ? "" : " ") + to_string(context_ptr->get_context_data(level)->parms().coeff_modulus().size());
+    return name;
+}
+
+void relinearizeProduct(Ciphertext & product, const Evaluator * evaluator_ptr, const RelinKeys * relinkeys_ptr)
+{
+    if (product.size() > 2) evaluator_ptr->relinearize_inplace(product, *relinkeys_ptr);
+}
+
+} // fhe
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "seal/seal.h"
+
+namespace fhe
+{
+
+// how the depth-optimized product of a partition is evaluated
+enum class Product
+{
+    multiply_many, // SEAL's Evaluator::multiply_many, which relinearizes after every multiplication
+    tree, // balanced tree of multiplications, relinearizing every product, with optional mod switches between levels
+    lazy // as tree, but the root is left at size 3 and relinearized by relinearizeProduct once the caller switched it down
+};
+
+Product parseProduct(const std::string & name); // "multiply_many", "tree" or "lazy"
+std::string productName(Product product);
+
+// the method of a partition's product and the modulus level of each of its tree levels
+struct ProductPlan
+{
+    Product method = Product::multiply_many;
+    std::vector<seal::parms_id_type> levels; // before tree level d (0 for the operands), every ciphertext is switched down to levels[d]
+};
+
+// Noise-budget-driven planner: each tree level of the product of 'num_operands' ciphertexts at 'operand_level' is switched
+// down as far as the result keeps its noise budget after the rest of the pipeline (a random plaintext mask if 'masked', the
+// switch to the last level and the lazy relinearization). The budget is measured on trial ciphertexts under a throwaway key,
+// as noise growth does not depend on the key. Without 'level_aware', or for multiply_many, every level stays at the operands' one
+ProductPlan planProduct
+(
+    const seal::SEALContext * context_ptr,
+    uint64_t num_operands,
+    Product method,
+    bool level_aware,
+    bool masked,
+    const seal::parms_id_type & operand_level
+);
+
+// lowest level fresh operands of such a product can be switched down to before it, with any method
+seal::parms_id_type planOperandLevel(const seal::SEALContext * context_ptr, uint64_t num_operands, Product method);
+
+// number of primes of each tree level, for display
+std::string levelsName(const ProductPlan & plan, const seal::SEALContext * context_ptr);
+
+// product of the operands, which must not be below plan.levels[0]; multiply_many ignores the levels
+void multiplyTree
+(
+    const std::vector<seal::Ciphertext> & operands,
+    seal::Ciphertext & product,
+    const ProductPlan & plan,
+    const seal::Evaluator * evaluator_ptr,
+    const seal::RelinKeys * relinkeys_ptr
+);
+
+// relinearizes a root that multiplyTree left at size 3, and leaves any other ciphertext untouched
+void relinearizeProduct(seal::Ciphertext & product, const seal::Evaluator * evaluator_ptr, const seal::RelinKeys * relinkeys_ptr);
+
+} // fhe
@@ -1,6 +1,7 @@
 #include "crypto_io.h"
 
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -14,6 +15,73 @@ using namespace std;
 namespace io
 {
 
+// 64-bit FNV-1a, used to detect changes (not a cryptographic hash)
+uint64_t digest(const string & bytes)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : bytes)
+    {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+uint64_t digest(const Kuckoo & cuckoo)
+{
+    stringstream ss;
+    ss << cuckoo;
+    return digest(ss.str());
+}
+
+uint64_t digest(const Ciphertext & ct)
+{
+    stringstream ss;
+    ct.save(ss);
+    return digest(ss.str());
+}
+
+Kuckoo loadCuckoo(const string & filename)
+{
+    ifstream file(filename + ".cuckoo", ios::binary);
+    if (!file.is_open()) throw "Could not open file '" + filename + ".cuckoo'";
+    Kuckoo cuckoo;
+    cuckoo.load(file);
+    return cuckoo;
+}
+
+vector<uint64_t> loadPresubtracted(const string & filename, const SEALContext * context_ptr, vector<Ciphertext> & table, uint64_t dummy, const TableVersion & version)
+{
+    // digests of the ciphertexts the cache was built from (none if there is no cache)
+    vector<uint64_t> digests;
+    {
+        ifstream file(filename + ".sub");
+        uint64_t cached_dummy, size;
+        if (file >> cached_dummy >> size && cached_dummy == dummy)
+        {
+            digests.resize(size);
+            for (auto & d : digests) file >> d;
+            if (!file) digests.clear();
+        }
+    }
+
+    vector<uint64_t> stale;
+    table.resize(version.digests.size());
+    for (uint64_t i = 0; i < table.size(); ++i)
+    {
+        if (i < digests.size() && digests[i] == version.digests[i])
+        {
+            ifstream file(filename + "_" + to_string(i) + ".sub.ct", ios::binary);
+            if (file.is_open()) { table[i].load(*context_ptr, file); continue; }
+        }
+        ifstream file(filename + "_" + to_string(i) + ".ct", ios::binary);
+        if (!file.is_open()) throw "Could not open file '" + filename + "_" + to_string(i) + ".ct'";
+        table[i].load(*context_ptr, file);
+        stale.push_back(i);
+    }
+    return stale;
+}
+
 GaloisKeys * loadGaloisKeys(const string & filename, const SEALContext * context_ptr)
 {
     ifstream file(filename, ios::binary);
@@ -44,14 +112,11 @@ SecretKey * loadSecretKey(const string & filename, const SEALContext * context_p
 tuple<Kuckoo, vector<Ciphertext>> loadTable(const string & filename, const SEALContext * context_ptr)
 {
     // Load table parameters
-    ifstream file_params(filename + ".params");
-    if (!file_params.is_open()) throw "Could not open file '" + filename + ".params";
-    Kuckoo cuckoo;
-    file_params >> cuckoo;
+    auto cuckoo = loadTableParameters(filename);
 
     // Load number of ciphertexts
     ifstream file_size(filename + ".size");
-    if (!file_size.is_open()) throw "Could not open file '" + filename + ".size";
+    if (!file_size.is_open()) throw "Could not open file '" + filename + ".size'";
     uint64_t size;
     file_size >> size;
 
@@ -61,7 +126,7 @@ tuple<Kuckoo, vector<Ciphertext>> loadTable(const string & filename, const SEALC
         for (uint64_t i = 0; i < size; ++i)
         {
             ifstream file(filename + "_" + to_string(i) + ".ct", ios::binary);
-            if (!file.is_open()) throw "Could not open file '" + filename + "." + to_string(i) + "'";
+            if (!file.is_open()) throw "Could not open file '" + filename + "_" + to_string(i) + ".ct'";
             Ciphertext ct;
             ct.load(*context_ptr, file);
             table.push_back(ct);
@@ -71,6 +136,58 @@ tuple<Kuckoo, vector<Ciphertext>> loadTable(const string & filename, const SEALC
     return {cuckoo, table};
 }
 
+tuple<Kuckoo, vector<Ciphertext>> loadTable(const string & filename, const SEALContext * context_ptr, const vector<uint64_t> & indices)
+{
+    // Load table parameters
+    auto cuckoo = loadTableParameters(filename);
+
+    // Load number of ciphertexts
+    ifstream file_size(filename + ".size");
+    if (!file_size.is_open()) throw "Could not open file '" + filename + ".size'";
+    uint64_t size;
+    file_size >> size;
+
+    // Load the given table ciphertexts only
+    vector<Ciphertext> table(size);
+    for (auto i : indices)
+    {
+        ifstream file(filename + "_" + to_string(i) + ".ct", ios::binary);
+        if (!file.is_open()) throw "Could not open file '" + filename + "_" + to_string(i) + ".ct'";
+        table[i].load(*context_ptr, file);
+    }
+
+    return {cuckoo, table};
+}
+
+Kuckoo loadTableParameters(const string & filename)
+{
+    ifstream file(filename + ".params");
+    if (!file.is_open()) throw "Could not open file '" + filename + ".params'";
+    Kuckoo cuckoo;
+    file >> cuckoo;
+    return cuckoo;
+}
+
+TableVersion loadVersion(const string & filename)
+{
+    ifstream file(filename + ".version");
+    if (!file.is_open()) throw "Could not open file '" + filename + ".version'";
+    TableVersion version;
+    uint64_t size;
+    file >> version.version >> version.params_digest >> size;
+    version.digests.resize(size);
+    for (auto & d : version.digests) file >> d;
+    if (!(file >> version.level)) version.level = 0; // not recorded by older tables
+    return version;
+}
+
+void saveCuckoo(const string & filename, const Kuckoo & cuckoo)
+{
+    ofstream file(filename + ".cuckoo", ios::binary);
+    if (!file.is_open()) throw "Could not open file '" + filename + ".cuckoo'";
+    cuckoo.save(file);
+}
+
 void saveGaloisKeys(const string & filename, const GaloisKeys * galoiskeys_ptr)
 {
     ofstream file(filename, ios::binary);
@@ -79,6 +196,22 @@ void saveGaloisKeys(const string & filename, const GaloisKeys * galoiskeys_ptr)
     galoiskeys_ptr->save(file);
 }
 
+void savePresubtracted(const string & filename, const vector<Ciphertext> & table, uint64_t dummy, const TableVersion & version, const vector<uint64_t> & indices)
+{
+    for (auto i : indices)
+    {
+        ofstream file(filename + "_" + to_string(i) + ".sub.ct", ios::binary);
+        if (!file.is_open()) throw "Could not open file '" + filename + "_" + to_string(i) + ".sub.ct'";
+        table[i].save(file);
+    }
+
+    // written last, so an interrupted save leaves the rewritten entries stale
+    ofstream file(filename + ".sub");
+    if (!file.is_open()) throw "Could not open file '" + filename + ".sub'";
+    file << dummy << ' ' << version.digests.size() << '\n';
+    for (auto d : version.digests) file << d << '\n';
+}
+
 void saveRelinKeys(const string & filename, const RelinKeys * relinkeys_ptr)
 {
     ofstream file(filename, ios::binary);
@@ -99,12 +232,12 @@ void saveTable(const string & filename, const Kuckoo & cuckoo, const vector<Ciph
 {
     // Save table parameters
     ofstream file_params(filename + ".params");
-    if (!file_params.is_open()) throw "Could not open file '" + filename + ".params";
+    if (!file_params.is_open()) throw "Could not open file '" + filename + ".params'";
     file_params << cuckoo;
 
     // Save number of ciphertexts
     ofstream file_size(filename + ".size");
-    if (!file_size.is_open()) throw "Could not open file '" + filename + ".size";
+    if (!file_size.is_open()) throw "Could not open file '" + filename + ".size'";
     file_size << table.size();
 
     // Save table ciphertexts (one ciphertext per file)
@@ -112,10 +245,40 @@ void saveTable(const string & filename, const Kuckoo & cuckoo, const vector<Ciph
         for (uint64_t i = 0; i < table.size(); ++i)
         {
             ofstream file(filename + "_" + to_string(i) + ".ct", ios::binary);
-            if (!file.is_open()) throw "Could not open file '" + filename + "." + to_string(i) + "'";
+            if (!file.is_open()) throw "Could not open file '" + filename + "_" + to_string(i) + ".ct'";
             table[i].save(file);
         }
     }
 }
 
+void saveTable(const string & filename, const Kuckoo & cuckoo, const vector<Ciphertext> & table, const vector<uint64_t> & indices)
+{
+    // Save table parameters
+    ofstream file_params(filename + ".params");
+    if (!file_params.is_open()) throw "Could not open file '" + filename + ".params'";
+    file_params << cuckoo;
+
+    // Save number of ciphertexts
+    ofstream file_size(filename + ".size");
+    if (!file_size.is_open()) throw "Could not open file '" + filename + ".size'";
+    file_size << table.size();
+
+    // Overwrite the given table ciphertexts only
+    for (auto i : indices)
+    {
+        ofstream file(filename + "_" + to_string(i) + ".ct", ios::binary);
+        if (!file.is_open()) throw "Could not open file '" + filename + "_" + to_string(i) + ".ct'";
+        table[i].save(file);
+    }
+}
+
+void saveVersion(const string & filename, const TableVersion & version)
+{
+    ofstream file(filename + ".version");
+    if (!file.is_open()) throw "Could not open file '" + filename + ".version'";
+    file << version.version << ' ' << version.params_digest << ' ' << version.digests.size() << '\n';
+    for (auto d : version.digests) file << d << '\n';
+    file << version.level << '\n';
+}
+
 } // io
\ No newline at end of file
@@ -9,6 +9,29 @@
 namespace io
 {
 
+// table version with a digest of the parameters and of each ciphertext, to synchronize only what changed,
+// and the level the ciphertexts are stored at
+struct TableVersion
+{
+    uint64_t version = 0;
+    uint64_t params_digest = 0;
+    std::vector<uint64_t> digests;
+    uint64_t level = 0; // primes in the coefficient modulus of the table ciphertexts (not the stash ones), 0 for the first data level
+};
+
+uint64_t digest(const cuckoo::Kuckoo & cuckoo);
+
+uint64_t digest(const seal::Ciphertext & ct);
+
+uint64_t digest(const std::string & bytes);
+
+cuckoo::Kuckoo loadCuckoo(const std::string & filename);
+
+// pre-subtracted table cache of the Receiver: filename_i.sub.ct next to each filename_i.ct, and filename.sub with
+// the dummy and the digest of each ciphertext it was built from; fills 'table' (sized as 'version') from the cache,
+// falls back to filename_i.ct where the entry is missing or stale, and returns the indices that fell back
+std::vector<uint64_t> loadPresubtracted(const std::string & filename, const seal::SEALContext * context_ptr, std::vector<seal::Ciphertext> & table, uint64_t dummy, const TableVersion & version);
+
 seal::GaloisKeys * loadGaloisKeys(const std::string & filename, const seal::SEALContext * context_ptr);
 
 seal::RelinKeys * loadRelinKeys(const std::string & filename, const seal::SEALContext * context_ptr);
@@ -17,12 +40,27 @@ seal::SecretKey * loadSecretKey(const std::string & filename, const seal::SEALCo
 
 std::tuple<cuckoo::Kuckoo, std::vector<seal::Ciphertext>> loadTable(const std::string & filename, const seal::SEALContext * context_ptr);
 
+std::tuple<cuckoo::Kuckoo, std::vector<seal::Ciphertext>> loadTable(const std::string & filename, const seal::SEALContext * context_ptr, const std::vector<uint64_t> & indices);
+
+// the parameters of the table (filename.params) without its ciphertexts
+cuckoo::Kuckoo loadTableParameters(const std::string & filename);
+
+TableVersion loadVersion(const std::string & filename);
+
+void saveCuckoo(const std::string & filename, const cuckoo::Kuckoo & cuckoo);
+
 void saveGaloisKeys(const std::string & filename, const seal::GaloisKeys * galoiskeys_ptr);
 
+void savePresubtracted(const std::string & filename, const std::vector<seal::Ciphertext> & table, uint64_t dummy, const TableVersion & version, const std::vector<uint64_t> & indices);
+
 void saveRelinKeys(const std::string & filename, const seal::RelinKeys * relinkeys_ptr);
 
 void saveSecretKey(const std::string & filename, const seal::SecretKey * secret_key_ptr);
 
 void saveTable(const std::string & filename, const cuckoo::Kuckoo & cuckoo, const std::vector<seal::Ciphertext> & table);
 
+void saveTable(const std::string & filename, const cuckoo::Kuckoo & cuckoo, const std::vector<seal::Ciphertext> & table, const std::vector<uint64_t> & indices);
+
+void saveVersion(const std::string & filename, const TableVersion & version);
+
 } // io
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <stdexcept>
 #include <tuple>
 #include <vector>
 #include <unordered_map>
@@ -15,6 +16,8 @@ using namespace std;
 namespace io
 {
 
+static bool parseBool(const string & value);
+
 ComputeParameters::ComputeParameters(const unordered_map<string, string> & params)
 try
 {
@@ -24,6 +27,9 @@ try
     rcvbuf_size = stoi(params.at("rcvbuf_size"));
     sndbuf_size = stoi(params.at("sndbuf_size"));
     num_threads = stoull(params.at("num_threads"));
+    multi_query = params.count("multi_query") ? parseBool(params.at("multi_query")) : false;
+    allow_multi_query = params.count("allow_multi_query") ? parseBool(params.at("allow_multi_query")) : false;
+    mask_pool_depth = params.count("mask_pool_depth") ? stoull(params.at("mask_pool_depth")) : 0;
 }
 catch (const exception & e) { throw "Error when parsing computing parameters"; }
 
@@ -39,6 +45,8 @@ try
     auto t = split(params.at("ti"), ',');
     for (auto & ti : t) this->ti.push_back(stoull(ti));
     eta = stoull(params.at(key + "_eta"));
+    product = params.count(key + "_product") ? fhe::parseProduct(params.at(key + "_product")) : fhe::Product::multiply_many;
+    level_aware = params.count(key + "_level_aware") ? parseBool(params.at(key + "_level_aware")) : false;
 }
 catch (const exception & e) { throw "Error when parsing encryption parameters"; }
 
@@ -47,6 +55,10 @@ try
 {
     auto filenames = split(params.at("set"), ',');
     for (auto & f : filenames) this->filenames.push_back(params.at("path") + f);
+    if (params.count("set_insert"))
+        for (auto & f : split(params.at("set_insert"), ',')) insert_filenames.push_back(params.at("path") + f);
+    if (params.count("set_erase"))
+        for (auto & f : split(params.at("set_erase"), ',')) erase_filenames.push_back(params.at("path") + f);
     bitsize = stoull(params.at("bit_size"));
 }
 catch (const exception & e) { throw "Error when parsing set parameters"; }
@@ -60,6 +72,17 @@ try
     table_size = 1LL << (stoull(params.at("log_table_size")) - (num_tables-1LL));
     max_data = math::shiftLeft(1ULL, stoull(params.at("bit_size"))) - 1ULL;
     max_depth = stoull(params.at("max_depth"));
+    stash_size = params.count("stash_size") ? stoull(params.at("stash_size")) : 0;
+    bin_width = params.count("bin_width") ? stoull(params.at("bin_width")) : 1;
+    insertion = cuckoo::Insertion::random_walk;
+    if (params.count("insertion"))
+    {
+        auto & name = params.at("insertion");
+        if (name == "bfs") insertion = cuckoo::Insertion::bfs;
+        else if (name == "min_counter") insertion = cuckoo::Insertion::min_counter;
+        else if (name != "random_walk") throw invalid_argument(name);
+    }
+    max_rehashes = params.count("max_rehashes") ? stoull(params.at("max_rehashes")) : 0;
 }
 catch (const exception & e) { throw "Error when parsing hash table parameters"; }
 
@@ -71,6 +94,9 @@ ostream & operator<<(ostream & os, const ComputeParameters & params)
     os << "Receive buffer size: " << params.rcvbuf_size << endl;
     os << "Send buffer size: " << params.sndbuf_size << endl;
     os << "Number of threads: " << params.num_threads << endl;
+    os << "Multi-query packing: " << (params.multi_query ? "true" : "false") << endl;
+    os << "Multi-query packing allowed: " << (params.allow_multi_query ? "true" : "false") << endl;
+    os << "Mask pool depth: " << params.mask_pool_depth << endl;
     return os;
 }
 
@@ -90,6 +116,8 @@ ostream & operator<<(ostream & os, const EncryptionParameters & params)
     if (params.ti.size() > 0) os << params.ti[0];
     for (size_t i = 1; i < params.ti.size(); i++) os << " + " << params.ti[i];
     os << ")" << endl;
+    os << "Product: " << fhe::productName(params.product) << endl;
+    os << "Level-aware product: " << (params.level_aware ? "true" : "false") << endl;
     return os;
 }
 
@@ -97,6 +125,10 @@ ostream & operator<<(ostream & os, const SetParameters & params)
 {
     os << "Set filenames:" << endl;
     for (auto & f : params.filenames) os << f << endl;
+    if (!params.insert_filenames.empty()) os << "Set filenames (insert):" << endl;
+    for (auto & f : params.insert_filenames) os << f << endl;
+    if (!params.erase_filenames.empty()) os << "Set filenames (erase):" << endl;
+    for (auto & f : params.erase_filenames) os << f << endl;
     os << "Bit size: " << params.bitsize << endl;
     return os;
 }
@@ -109,6 +141,16 @@ ostream & operator<<(ostream & os, const TableParameters & params)
     os << "Max data: " << params.max_data << endl;
     os << "Max depth: " << params.max_depth << endl;
     os << "Number of tables: " << params.num_tables << endl;
+    os << "Stash size: " << params.stash_size << endl;
+    os << "Bin width: " << params.bin_width << endl;
+    os << "Insertion: ";
+    switch (params.insertion)
+    {
+        case cuckoo::Insertion::random_walk: os << "random_walk" << endl; break;
+        case cuckoo::Insertion::bfs: os << "bfs" << endl; break;
+        case cuckoo::Insertion::min_counter: os << "min_counter" << endl; break;
+    }
+    os << "Max rehashes: " << params.max_rehashes << endl;
     return os;
 }
 
@@ -164,6 +206,14 @@ vector<string> split(const string & s, char delimiter)
     return tokens;
 }
 
+// Function to parse "true" or "false"
+static bool parseBool(const string & value)
+{
+    if (value == "true") return true;
+    if (value == "false") return false;
+    throw invalid_argument(value);
+}
+
 // Function to trim whitespace from both ends of a string
 string trim(const string & str)
 {
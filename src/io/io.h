@@ -6,6 +6,8 @@
 #include <tuple>
 #include <vector>
 #include <unordered_map>
+#include "kuckoo.h"
+#include "product.h"
 
 namespace io
 {
@@ -18,6 +20,9 @@ struct ComputeParameters
     int rcvbuf_size;
     int sndbuf_size;
     uint64_t num_threads;
+    bool multi_query; // Receiver packs the elements that hit the same ciphertexts into shared queries
+    bool allow_multi_query; // Sender accepts multi-query packing, which reveals where in its table each match is
+    uint64_t mask_pool_depth; // masks precomputed while idle, by the Receiver for its queries and by the Sender for recrypt
 
     ComputeParameters() = default;
     ComputeParameters(const std::unordered_map<std::string, std::string> & params);
@@ -34,6 +39,8 @@ struct EncryptionParameters
     std::vector<int> logqi;
     std::vector<uint64_t> ti;
     uint64_t eta;
+    fhe::Product product; // how the product of each eta partition is evaluated
+    bool level_aware; // tree levels of the product are switched down to the lowest modulus the noise budget allows
 
     EncryptionParameters() = default;
     EncryptionParameters(const std::unordered_map<std::string, std::string> & params, const std::string & key);
@@ -44,6 +51,8 @@ struct EncryptionParameters
 struct SetParameters
 {
     std::vector<std::string> filenames;
+    std::vector<std::string> insert_filenames;
+    std::vector<std::string> erase_filenames;
     uint64_t bitsize;
 
     SetParameters() = default;
@@ -60,6 +69,10 @@ struct TableParameters
     uint64_t max_data;
     uint64_t max_depth;
     uint64_t num_tables;
+    uint64_t stash_size;
+    uint64_t bin_width;
+    cuckoo::Insertion insertion;
+    uint64_t max_rehashes;
 
     TableParameters() = default;
     TableParameters(const std::unordered_map<std::string, std::string> & params);
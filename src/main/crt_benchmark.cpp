@@ -0,0 +1,106 @@
+// Microbenchmark of the CRT packing kernels
+// Compares the original formulas (64-bit products reduced once, one division per component) against crtEncode and crtDecode,
+// and a scalar loop of CrtParams::isZero against crtCountZeros
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "crt.h"
+#include "random.h"
+
+using namespace math;
+using namespace std;
+using namespace std::chrono;
+
+// nanoseconds per slot of f() over 'slots' slots
+template <class F>
+double nsPerSlot(uint64_t slots, uint64_t repetitions, F f)
+{
+    auto start = high_resolution_clock::now();
+    for (uint64_t r = 0; r < repetitions; r++) f();
+    auto end = high_resolution_clock::now();
+    return double(duration_cast<nanoseconds>(end - start).count()) / (repetitions * slots);
+}
+
+int main(int argc, char * argv[])
+try
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " <ti> <slots> <repetitions>" << endl;
+        cerr << "ti: comma-separated plaintext moduli, as in the parameter files (e.g. 40961,65537)" << endl;
+        cerr << "slots: number of slots per vector (default: 8192)" << endl;
+        cerr << "repetitions: number of repetitions (default: 1000)" << endl;
+        return 1;
+    }
+    vector<uint64_t> ti;
+    {
+        istringstream list(argv[1]);
+        string t;
+        while (getline(list, t, ',')) ti.push_back(stoull(t));
+    }
+    uint64_t slots = argc > 2 ? stoull(argv[2]) : 8192;
+    uint64_t repetitions = argc > 3 ? stoull(argv[3]) : 1000;
+
+    auto crt = crtParams(ti);
+    const uint64_t k = crt.mi.size();
+    cout << "M: " << crt.M << ", k: " << k << ", slots: " << slots << ", repetitions: " << repetitions << endl;
+
+    // random components, as in the table and query plaintexts
+    vector<uint64_t> vs(k * slots), vpack(slots), decoded;
+    for (uint64_t i = 0; i < slots; i++)
+        for (uint64_t j = 0; j < k; j++) vs[i*k + j] = generator().uniform(0, crt.mi[j] - 1);
+
+    auto legacy_encode = [&crt, &vs, &vpack, k]()
+    {
+        for (uint64_t i = 0; i < vpack.size(); i++)
+        {
+            vpack[i] = 0;
+            for (uint64_t j = 0; j < k; j++) vpack[i] += vs[i*k + j] * (crt.Mi[j] * crt.iMi[j]);
+            vpack[i] %= crt.M;
+        }
+    };
+    auto legacy_decode = [&crt, &vpack, &decoded, k]()
+    {
+        decoded.resize(vpack.size() * k);
+        for (uint64_t i = 0; i < vpack.size(); i++)
+            for (uint64_t j = 0; j < k; j++) decoded[i*k + j] = vpack[i] % crt.mi[j];
+    };
+    auto encode = [&crt, &vs, &vpack]() { vpack = crtEncode(vs, crt); };
+    auto decode = [&crt, &vpack, &decoded]() { crtDecode(vpack.data(), vpack.size(), crt, decoded.data()); };
+    uint64_t scalar_zeros = 0, zeros = 0;
+    auto scalar_count = [&crt, &vpack, &scalar_zeros, k]()
+    {
+        scalar_zeros = 0;
+        for (uint64_t i = 0; i < vpack.size(); i++)
+            for (uint64_t j = 0; j < k; j++) scalar_zeros += crt.isZero(vpack[i], j);
+    };
+    auto count = [&crt, &vpack, &zeros]() { zeros = crtCountZeros(vpack.data(), vpack.size(), crt, ~0ULL); };
+
+    double time_legacy_encode = nsPerSlot(slots, repetitions, legacy_encode);
+    legacy_decode();
+    uint64_t legacy_errors = 0;
+    for (uint64_t c = 0; c < vs.size(); c++) legacy_errors += decoded[c] != vs[c];
+    double time_legacy_decode = nsPerSlot(slots, repetitions, legacy_decode);
+
+    double time_encode = nsPerSlot(slots, repetitions, encode);
+    double time_decode = nsPerSlot(slots, repetitions, decode);
+    uint64_t errors = 0;
+    double time_scalar_count = nsPerSlot(slots, repetitions, scalar_count);
+    double time_count = nsPerSlot(slots, repetitions, count);
+    for (uint64_t c = 0; c < vs.size(); c++) errors += decoded[c] != vs[c];
+
+    cout << "legacy crtEncode: " << time_legacy_encode << " ns/slot, " << legacy_errors << " wrong components (64-bit overflow)" << endl;
+    cout << "legacy crtDecode: " << time_legacy_decode << " ns/slot" << endl;
+    cout << "crtEncode: " << time_encode << " ns/slot" << endl;
+    cout << "crtDecode: " << time_decode << " ns/slot, " << errors << " wrong components after a round trip" << endl;
+    cout << "scalar isZero loop: " << time_scalar_count << " ns/slot" << endl;
+    cout << "crtCountZeros: " << time_count << " ns/slot, " << zeros << " zeros (scalar: " << scalar_zeros << ")" << endl;
+}
+catch (const exception & e) { cerr << e.what() << endl; return 1; }
+catch (const char * e) { cerr << e << endl; return 1; }
+catch (const string & e) { cerr << e << endl; return 1; }
+catch (...) { cerr << "Unknown exception" << endl; return 1; }
@@ -0,0 +1,81 @@
+// Microbenchmark of the Cuckoo table construction
+// Builds tables of random distinct values and counts how many builds succeed, without and with rehashing
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "kuckoo.h"
+
+using namespace cuckoo;
+using namespace std;
+using namespace std::chrono;
+
+int main(int argc, char * argv[])
+try
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " <log2 slots> <tables> <hashes> <load> <threshold> <threads> <trials> <max rehashes> <stash size>" << endl;
+        cerr << "log2 slots: log2 of the number of slots per table (default: 14)" << endl;
+        cerr << "tables: number of tables (default: 2)" << endl;
+        cerr << "hashes: number of hash functions (default: 3)" << endl;
+        cerr << "load: number of values over the number of slots of all tables (default: 0.8)" << endl;
+        cerr << "threshold: maximum number of evictions per insertion (default: 30)" << endl;
+        cerr << "threads: number of threads (default: 4)" << endl;
+        cerr << "trials: number of tables built (default: 20)" << endl;
+        cerr << "max rehashes: rehash rounds allowed per build (default: 10)" << endl;
+        cerr << "stash size: (default: 0)" << endl;
+        return 1;
+    }
+    uint64_t log2_slots = stoull(argv[1]);
+    uint64_t num_tables = argc > 2 ? stoull(argv[2]) : 2;
+    uint64_t num_hashes = argc > 3 ? stoull(argv[3]) : 3;
+    double load = argc > 4 ? stod(argv[4]) : 0.8;
+    uint64_t threshold = argc > 5 ? stoull(argv[5]) : 30;
+    uint64_t num_threads = argc > 6 ? stoull(argv[6]) : 4;
+    uint64_t trials = argc > 7 ? stoull(argv[7]) : 20;
+    uint64_t max_rehashes = argc > 8 ? stoull(argv[8]) : 10;
+    uint64_t stash_size = argc > 9 ? stoull(argv[9]) : 0;
+
+    const uint64_t table_size = 1ULL << log2_slots;
+    const uint64_t num_values = uint64_t(load * table_size * num_tables);
+    cout << "slots: " << num_tables << " x 2^" << log2_slots << ", hashes: " << num_hashes << ", values: " << num_values
+         << ", threshold: " << threshold << ", threads: " << num_threads << ", stash: " << stash_size << endl;
+
+    mt19937_64 gen(random_device{}());
+    uint64_t first = 0, rehashed = 0, rehashes = 0;
+    double seconds = 0;
+    for (uint64_t trial = 0; trial < trials; trial++)
+    {
+        // random distinct 32-bit values, as in the generated sets
+        unordered_set<uint64_t> distinct;
+        while (distinct.size() < num_values) distinct.insert(gen() >> 32);
+        vector<uint64_t> set(distinct.begin(), distinct.end());
+
+        Kuckoo cuckoo(num_hashes, table_size, (1ULL << 32) - 1, threshold, num_tables, stash_size);
+        auto start = steady_clock::now();
+        try
+        {
+            cuckoo.insert(set, num_threads, max_rehashes);
+            if (cuckoo.getRehashes()) rehashed++;
+            else first++;
+            rehashes += cuckoo.getRehashes();
+        }
+        catch (const runtime_error &) {}
+        seconds += duration<double>(steady_clock::now() - start).count();
+    }
+
+    cout << "built without rehashing: " << first << " of " << trials << endl;
+    cout << "built with at most " << max_rehashes << " rehashes: " << first + rehashed << " of " << trials
+         << " (" << rehashes << " tables rehashed by the successful builds)" << endl;
+    cout << "time: " << seconds / trials << " s/build" << endl;
+}
+catch (const exception & e) { cerr << e.what() << endl; return 1; }
+catch (const char * e) { cerr << e << endl; return 1; }
+catch (const string & e) { cerr << e << endl; return 1; }
+catch (...) { cerr << "Unknown exception" << endl; return 1; }
@@ -0,0 +1,116 @@
+// Microbenchmark of the Cuckoo hash functions
+// Compares the original 64-bit formula (wrapping products, two divisions) against Hash
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "hash.h"
+#include "prime.h"
+
+using namespace cuckoo;
+using namespace math;
+using namespace std;
+using namespace std::chrono;
+
+// nanoseconds per hash of f(values, out), the fastest of the repetitions so other load on the machine only slows some of them
+template <class F>
+double nsPerHash(const vector<uint64_t> & values, vector<uint64_t> & out, uint64_t repetitions, F f)
+{
+    double best = 0;
+    for (uint64_t r = 0; r < repetitions; r++)
+    {
+        auto start = high_resolution_clock::now();
+        f(values, out);
+        auto end = high_resolution_clock::now();
+        double time = double(duration_cast<nanoseconds>(end - start).count()) / values.size();
+        if (!r || time < best) best = time;
+    }
+    return best;
+}
+
+// fraction of bins that received no value
+double emptyBins(const vector<uint64_t> & bins, uint64_t num_bins)
+{
+    vector<bool> used(num_bins, false);
+    for (auto bin : bins) used[bin] = true;
+    return double(count(used.begin(), used.end(), false)) / num_bins;
+}
+
+int main(int argc, char * argv[])
+try
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " <log2 bins> <values> <repetitions>" << endl;
+        cerr << "log2 bins: log2 of the number of bins (default: 20)" << endl;
+        cerr << "values: number of values hashed per repetition (default: 1048576)" << endl;
+        cerr << "repetitions: number of repetitions (default: 16)" << endl;
+        return 1;
+    }
+    uint64_t log2_bins = stoull(argv[1]);
+    uint64_t num_values = argc > 2 ? stoull(argv[2]) : 1 << 20;
+    uint64_t repetitions = argc > 3 ? stoull(argv[3]) : 16;
+
+    // hash parameters drawn as in the Kuckoo constructor
+    mt19937_64 gen(random_device{}());
+    const uint64_t num_bins = 1ULL << log2_bins;
+    uniform_int_distribution<uint64_t> dist_table(0, num_bins-1);
+    uint64_t prime = generatePrime(num_bins * num_bins + dist_table(gen));
+    uniform_int_distribution<uint64_t> dist_prime(0, prime-1);
+    uint64_t c0 = dist_table(gen);
+    uint64_t c1;
+    do { c1 = generatePrime(dist_table(gen)); } while (num_bins % c1 == 0);
+    uint64_t c2 = generatePrime(dist_prime(gen));
+    uint64_t c3 = dist_prime(gen);
+    uint64_t seed = gen() >> 32;
+    Hash hash({c0, c1, c2, c3}, num_bins, prime, seed);
+
+    // random 32-bit values, as in the generated sets
+    vector<uint64_t> values(num_values), out(num_values);
+    for (auto & value : values) value = gen() >> 32;
+
+    cout << "bins: 2^" << log2_bins << ", prime: " << prime << ", values: " << num_values << ", repetitions: " << repetitions << endl;
+
+    auto legacy = [c0, c1, c2, c3, prime, num_bins, seed](const vector<uint64_t> & vs, vector<uint64_t> & hs)
+    {
+        for (uint64_t i = 0; i < vs.size(); i++) hs[i] = (((c3 * (vs[i] ^ seed) + c2) % prime) * c1 + c0) % num_bins;
+    };
+    // the same formula with the number of bins read at run time, as Kuckoo did: the compiler can no longer
+    // turn the second division into a mask, as it does above where num_bins is visibly a power of two
+    volatile uint64_t runtime_bins = num_bins;
+    auto legacy_runtime = [c0, c1, c2, c3, prime, &runtime_bins, seed](const vector<uint64_t> & vs, vector<uint64_t> & hs)
+    {
+        const uint64_t bins = runtime_bins;
+        for (uint64_t i = 0; i < vs.size(); i++) hs[i] = (((c3 * (vs[i] ^ seed) + c2) % prime) * c1 + c0) % bins;
+    };
+    auto scalar = [&hash](const vector<uint64_t> & vs, vector<uint64_t> & hs)
+    {
+        for (uint64_t i = 0; i < vs.size(); i++) hs[i] = hash.hash(vs[i]);
+    };
+    auto batch = [&hash](const vector<uint64_t> & vs, vector<uint64_t> & hs)
+    {
+        hash.hash(vs.data(), vs.size(), hs.data());
+    };
+
+    double time_legacy = nsPerHash(values, out, repetitions, legacy);
+    double empty_legacy = emptyBins(out, num_bins);
+    double time_legacy_runtime = nsPerHash(values, out, repetitions, legacy_runtime);
+    double time_scalar = nsPerHash(values, out, repetitions, scalar);
+    double time_batch = nsPerHash(values, out, repetitions, batch);
+    double empty_hash = emptyBins(out, num_bins);
+
+    cout << "empty bins expected for uniform hashing: " << exp(-double(num_values) / num_bins) << endl;
+    cout << "legacy (64-bit, division and mask): " << time_legacy << " ns/hash, empty bins " << empty_legacy << endl;
+    cout << "legacy (64-bit, two divisions): " << time_legacy_runtime << " ns/hash" << endl;
+    cout << "Hash::hash: " << time_scalar << " ns/hash" << endl;
+    cout << "Hash::hash (batch): " << time_batch << " ns/hash, empty bins " << empty_hash << endl;
+}
+catch (const exception & e) { cerr << e.what() << endl; return 1; }
+catch (const char * e) { cerr << e << endl; return 1; }
+catch (const string & e) { cerr << e << endl; return 1; }
+catch (...) { cerr << "Unknown exception" << endl; return 1; }
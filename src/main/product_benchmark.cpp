@@ -0,0 +1,94 @@
+// Benchmark of the depth-optimized product of one eta partition
+// Compares SEAL's multiply_many against multiplyTree, eager and lazy, at the top level and level-aware, each followed by the final
+// modulus switch
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bfv.h"
+#include "io.h"
+#include "product.h"
+#include "random.h"
+#include "seal/seal.h"
+
+using namespace fhe;
+using namespace math;
+using namespace seal;
+using namespace std;
+using namespace std::chrono;
+
+int main(int argc, char * argv[])
+try
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " <h> <eta> <ti> <repetitions>" << endl;
+        cerr << "h: number of hash functions (default: 4)" << endl;
+        cerr << "eta: partitioning parameter, the partition multiplies ceil(h/(eta+1)) ciphertexts (default: 0)" << endl;
+        cerr << "ti: comma-separated plaintext moduli, as in the parameter files (default: 40961)" << endl;
+        cerr << "repetitions: number of repetitions (default: 10)" << endl;
+        return 1;
+    }
+    uint64_t h = stoull(argv[1]);
+    uint64_t eta = argc > 2 ? stoull(argv[2]) : 0;
+    vector<uint64_t> ti;
+    for (auto & t : io::split(argc > 3 ? argv[3] : "40961", ',')) ti.push_back(stoull(t));
+    uint64_t repetitions = argc > 4 ? stoull(argv[4]) : 10;
+    uint64_t num_operands = h / (eta + 1) + bool(h % (eta + 1));
+
+    // parameters of 'protocol.cpp'
+    uint64_t n = 1 << 12; vector<int> logqi{27, 27, 27, 28};
+    SEALContext* context_ptr;
+    do { context_ptr = instantiateEncryptionScheme(n, logqi, ti); }
+    while (!validKeys(context_ptr));
+    auto [secret_key_ptr, relinkeys_ptr, galoiskeys_ptr] = generateKeys(context_ptr, false);
+    auto [encoder_ptr, evaluator_ptr] = generateEvaluator(context_ptr);
+    Encryptor encryptor(*context_ptr, *secret_key_ptr);
+    Decryptor decryptor(*context_ptr, *secret_key_ptr);
+    const uint64_t t = context_ptr->first_context_data()->parms().plain_modulus().value();
+
+    // random operands and the expected product of their slots
+    vector<Ciphertext> operands(num_operands);
+    vector<uint64_t> expected(n, 1);
+    for (auto & ct : operands)
+    {
+        auto values = randomVector(n, 0, t - 1);
+        for (uint64_t s = 0; s < n; s++) expected[s] = uint64_t((unsigned __int128)(expected[s]) * values[s] % t);
+        Plaintext pt;
+        encoder_ptr->encode(values, pt);
+        encryptor.encrypt_symmetric(pt, ct);
+    }
+    cout << "t: " << t << ", operands: " << num_operands << ", repetitions: " << repetitions << endl;
+
+    vector<ProductPlan> plans;
+    for (auto method : {Product::multiply_many, Product::tree, Product::lazy}) plans.push_back(planProduct(context_ptr, num_operands, method, false, false, context_ptr->first_parms_id()));
+    for (auto method : {Product::tree, Product::lazy}) plans.push_back(planProduct(context_ptr, num_operands, method, true, false, context_ptr->first_parms_id()));
+
+    for (const auto & plan : plans)
+    {
+        Ciphertext product;
+        auto start = high_resolution_clock::now();
+        for (uint64_t r = 0; r < repetitions; r++)
+        {
+            multiplyTree(operands, product, plan, evaluator_ptr, relinkeys_ptr);
+            evaluator_ptr->mod_switch_to_inplace(product, context_ptr->last_parms_id());
+            relinearizeProduct(product, evaluator_ptr, relinkeys_ptr);
+        }
+        auto end = high_resolution_clock::now();
+        double time = duration_cast<microseconds>(end - start).count() / 1000.0 / repetitions;
+
+        Plaintext pt;
+        vector<uint64_t> values;
+        decryptor.decrypt(product, pt);
+        encoder_ptr->decode(pt, values);
+        uint64_t errors = 0;
+        for (uint64_t s = 0; s < n; s++) errors += values[s] != expected[s];
+        cout << productName(plan.method) << " (primes per tree level: " << levelsName(plan, context_ptr) << "): " << time << " ms, noise budget: " << decryptor.invariant_noise_budget(product) << " bits, " << errors << " wrong slots" << endl;
+    }
+}
+catch (const exception & e) { cerr << e.what() << endl; return 1; }
+catch (const char * e) { cerr << e << endl; return 1; }
+catch (const string & e) { cerr << e << endl; return 1; }
+catch (...) { cerr << "Unknown exception" << endl; return 1; }
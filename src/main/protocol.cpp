@@ -2,23 +2,29 @@
 // For real-world deploying, use 'receiver_setup.cpp', 'sender_setup.cpp',
 // 'receiver_intersect.cpp', and 'sender_intersect.cpp' instead
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <unordered_set>
 #include <vector>
 #include "bfv.h"
 #include "crt.h"
+#include "crypto_io.h"
 #include "kuckoo.h"
 #include "math.h"
 #include "packing.h"
 #include "party.h"
+#include "product.h"
 #include "psi.h"
 #include "seal/seal.h"
+#include "stash.h"
 
 using namespace cuckoo;
 using namespace fhe;
+using namespace io;
 using namespace math;
 using namespace psi;
 using namespace seal;
@@ -28,17 +34,34 @@ using namespace std::chrono;
 using TimeUnit = milliseconds;
 const string time_unit = "ms";
 
+// compares the intersection found by the protocol with the plain one, and throws if they differ
+static void checkIntersection(vector<uint64_t> intersection, const Party & receiver, const unordered_set<uint64_t> & sender_values)
+{
+    vector<uint64_t> expected;
+    for (auto value : receiver.getSet()) if (sender_values.count(value)) expected.push_back(value);
+    sort(intersection.begin(), intersection.end());
+    sort(expected.begin(), expected.end());
+    if (intersection != expected)
+        throw "Intersection check failed: " + to_string(intersection.size()) + " elements found, " + to_string(expected.size()) + " expected";
+    cout << "Intersection check: passed" << endl;
+}
+
 int main(int argc, char * argv[])
 try
 {
     if (argc < 2)
     {
-        cerr << "Usage: " << argv[0] << " <mode> <log2|X|> <|Y|> <m> <threads>" << endl;
+        cerr << "Usage: " << argv[0] << " <mode> <log2|X|> <|Y|> <m> <threads> <stash size> <bin width> <max depth> <max rehashes> <check>" << endl;
         cerr << "mode: 0 (Fast Setup), 1 (Fast Intersection)" << endl;
         cerr << "log2|X|: log2 of the size of the Sender's set (default: 20)" << endl;
         cerr << "|Y|: size of the Receiver's set (default: 4)" << endl;
         cerr << "m: number of recurrencies (default: 1)" << endl;
         cerr << "threads: number of threads (default: 4)" << endl;
+        cerr << "stash size: number of elements the Cuckoo hash table may keep in a stash (default: 0)" << endl;
+        cerr << "bin width: number of consecutive slots per Cuckoo bin, 1, 2 or 4 (default: 1)" << endl;
+        cerr << "max depth: maximum number of evictions per insertion (default: 1024)" << endl;
+        cerr << "max rehashes: rehash rounds allowed when a table cannot take its elements (default: 0)" << endl;
+        cerr << "check: 1 compares each intersection with the plain one, also after an update of the Sender's set (default: 0)" << endl;
         return 1;
     }
     bool mode = stoi(argv[1]);
@@ -46,6 +69,11 @@ try
     uint64_t sizeY = argc > 3 ? stoi(argv[3]) : 4;
     uint64_t m = argc > 4 ? stoi(argv[4]) : 1;
     uint64_t num_threads = argc > 5 ? stoi(argv[5]) : 4;
+    uint64_t stash_size = argc > 6 ? stoi(argv[6]) : 0; // a stash of a few entries allows load factors close to 0.95
+    uint64_t bin_width = argc > 7 ? stoi(argv[7]) : 1; // 2 or 4 slots per bin allow higher load factors with fewer hash functions
+    uint64_t max_depth = argc > 8 ? stoi(argv[8]) : 1<<10;
+    uint64_t max_rehashes = argc > 9 ? stoi(argv[9]) : 0;
+    bool check = argc > 10 ? stoi(argv[10]) : false;
 
     /* Begin of parameters */
 
@@ -72,12 +100,15 @@ try
     uint64_t num_hashes = 4;
     uint64_t num_tables = k;
     uint64_t table_size = 1 << (log2X - (num_tables-1));
-    uint64_t max_depth = 1<<10;
     double load_factor = mode ? 0.86 : 0.87;
+    Insertion insertion = Insertion::random_walk; // bfs or min_counter need fewer evictions at load factors above 0.9
     
     // Partitioning parameters
     uint64_t sender_eta = mode ? 0 : 1; // [0,h-1], where 0 means full multiplication, h-1 means full partitioning
     uint64_t receiver_eta = mode ? 0 : 1; // [0, h-1-sender_eta], where 0 means full multiplication, h-1-sender_eta means full partitioning
+    Product sender_product = Product::multiply_many; // multiply_many, tree or lazy (the root is relinearized at the lowest level)
+    Product receiver_product = Product::multiply_many;
+    bool level_aware = false; // the table is stored at the lowest level the product allows, and tree and lazy switch each tree level down
 
     uint64_t time_sender_pre = 0;
     uint64_t time_sender = 0;
@@ -144,6 +175,18 @@ try
     auto receiver_decryptor_ptr = new Decryptor(*receiver_context_ptr, *receiver_secret_key_ptr);
     cout << "done." << endl;
 
+    // Plan the level of the table and the levels of the products of both parties
+    cout << "Planning product levels..." << flush;
+    const uint64_t sender_operands = num_hashes / (sender_eta + 1) + bool(num_hashes % (sender_eta + 1));
+    auto table_level = level_aware ? planOperandLevel(sender_context_ptr, sender_operands, sender_product) : sender_context_ptr->first_parms_id();
+    auto sender_plan = planProduct(sender_context_ptr, sender_operands, sender_product, level_aware, false, table_level);
+    auto receiver_plan = planProduct
+    (
+        receiver_context_ptr, (sender_eta + 1) / (receiver_eta + 1) + bool((sender_eta + 1) % (receiver_eta + 1)), receiver_product, level_aware, true,
+        receiver_context_ptr->first_parms_id()
+    );
+    cout << "done (primes per tree level: " << levelsName(sender_plan, sender_context_ptr) << " and " << levelsName(receiver_plan, receiver_context_ptr) << ")." << endl;
+
     /* End of setup */
 
     /* Begin of Cuckoo hashing */
@@ -151,16 +194,36 @@ try
     // k-table Cuckoo hashing with Permutation-based hashing
     cout << "Generating Cuckoo hash table..." << flush;
     start = high_resolution_clock::now();
-    Kuckoo cuckoo(num_hashes, table_size, max_data, max_depth, num_tables);
-    cuckoo.insert(sender.getSet());//, num_threads);
+    Kuckoo cuckoo(num_hashes, table_size, max_data, max_depth, num_tables, stash_size, bin_width);
+    if (get<3>(cuckoo.getParameters()) + 2 >= *min_element(ti.begin(), ti.end())) throw "Table values do not fit in the plaintext modulus";
+    cuckoo.setInsertion(insertion);
+    cuckoo.insert(sender.getSet(), num_threads, max_rehashes);
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     Kuckoo cuckoo_params(cuckoo.getParameters()); // this is what Receiver can see
     uint64_t receiver_dummy = get<3>(cuckoo.getParameters())+2;
+    uint64_t stash_repetitions = stashLayout(cuckoo_params, crt, sender_n).repetitions;
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
     time_sender_pre += time_span;
 
-    cout << "Cuckoo hash table size: " << cuckoo.getTable().size() << " x " << cuckoo.getTable()[0].size() << endl;
+    cout << "Cuckoo hash table size: " << cuckoo.getNumTables() << " x " << cuckoo.getTableSize() << endl;
+    cout << "Stash entries: " << cuckoo.getStash().size() << " of " << stash_size << endl;
+    cout << "Evictions per insert: " << double(cuckoo.getEvictions()) / sender.getSet().size() << endl;
+    cout << "Rehashed tables: " << cuckoo.getRehashes() << endl;
+
+    // The check needs the Sender's set in plain, and queries the stash entries too, which the random sets rarely hit
+    unordered_set<uint64_t> sender_values;
+    if (check)
+    {
+        sender_values.insert(sender.getSet().begin(), sender.getSet().end());
+        for (auto & receiver : receivers)
+        {
+            auto set = receiver.getSet();
+            unordered_set<uint64_t> values(set.begin(), set.end());
+            for (auto value : cuckoo.getStash()) if (!values.count(value)) set.push_back(value);
+            receiver = Party(set, bitsize);
+        }
+    }
 
     /* End of Cuckoo hashing */
 
@@ -170,7 +233,10 @@ try
     cout << "Encrypting Cuckoo hash table..." << flush;
     start = high_resolution_clock::now();
     vector<Ciphertext> encrypted_table;
-    packEncrypt(encrypted_table, cuckoo.getTable(), crt, sender_encoder_ptr, sender_encryptor_ptr, num_threads);
+    encryptTable(encrypted_table, cuckoo, crt, sender_encoder_ptr, sender_encryptor_ptr, num_threads);
+    vector<uint64_t> table_indices(encrypted_table.size());
+    for (uint64_t i=0; i<table_indices.size(); i++) table_indices[i] = i;
+    switchTable(encrypted_table, cuckoo, crt, sender_encoder_ptr, sender_evaluator_ptr, table_level, table_indices, num_threads);
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
@@ -186,94 +252,176 @@ try
     /* End of set encryption */
 
 
-    // For each Receiver's set
-    for (uint64_t idx=0; idx < receivers.size(); idx++)
+    // For each Receiver's set, against the encrypted table the Receiver holds
+    auto intersectAll = [&](const vector<Ciphertext> & receiver_table)
     {
-        /* Begin of set intersection */
-        uint64_t ch_idx0 = idx / 26;
-        uint64_t ch_idx1 = idx % 26;
-        auto tag = string(1, char('A' + ch_idx0)) + string(1, char('A' + ch_idx1));
-        auto & receiver = receivers[idx];
-
-        cout << "Computing intersection..." << flush;
-        start = high_resolution_clock::now();
-        vector<vector<Ciphertext>> results, randoms;
-        computeIntersection
-        (
-            results, randoms, receiver, cuckoo_params, encrypted_table, crt, sender_eta,
-            sender_context_ptr, sender_encoder_ptr, sender_evaluator_ptr, sender_relinkeys_ptr,
-            receiver_encoder_ptr, receiver_encryptor_ptr, receiver_dummy, num_threads
-        );
-        end = high_resolution_clock::now();
-        time_span = duration_cast<TimeUnit>(end - start).count();
-        cout << "done (" << time_span << " " << time_unit << ")" << endl;
-        time_receiver += time_span;
-
-        // save results and randoms
-        for (uint64_t i = 0; i < results.size(); i++)
+        for (uint64_t idx=0; idx < receivers.size(); idx++)
         {
-            for (uint64_t j = 0; j < results[i].size(); j++)
+            /* Begin of set intersection */
+            uint64_t ch_idx0 = idx / 26;
+            uint64_t ch_idx1 = idx % 26;
+            auto tag = string(1, char('A' + ch_idx0)) + string(1, char('A' + ch_idx1));
+            auto & receiver = receivers[idx];
+
+            cout << "Computing intersection..." << flush;
+            start = high_resolution_clock::now();
+            vector<vector<Ciphertext>> results, randoms;
+            computeIntersection
+            (
+                results, randoms, receiver, cuckoo_params, receiver_table, false, crt, sender_eta, sender_plan,
+                sender_context_ptr, sender_encoder_ptr, sender_evaluator_ptr, sender_relinkeys_ptr,
+                receiver_encoder_ptr, receiver_encryptor_ptr, receiver_dummy, nullptr, num_threads
+            );
+            end = high_resolution_clock::now();
+            time_span = duration_cast<TimeUnit>(end - start).count();
+            cout << "done (" << time_span << " " << time_unit << ")" << endl;
+            time_receiver += time_span;
+
+            // save results and randoms
+            for (uint64_t i = 0; i < results.size(); i++)
             {
+                for (uint64_t j = 0; j < results[i].size(); j++)
                 {
-                    string filename = tag + "_D_" + to_string(i) + "_" + to_string(j) + ".tmp";
-                    ofstream fout(filename);
-                    results[i][j].save(fout);
-                }
-                {
-                    string filename = tag + "_R_" + to_string(i) + "_" + to_string(j) + ".tmp";
-                    ofstream fout(filename);
-                    randoms[i][j].save(fout);
+                    {
+                        string filename = tag + "_D_" + to_string(i) + "_" + to_string(j) + ".tmp";
+                        ofstream fout(filename);
+                        results[i][j].save(fout);
+                    }
+                    {
+                        string filename = tag + "_R_" + to_string(i) + "_" + to_string(j) + ".tmp";
+                        ofstream fout(filename);
+                        randoms[i][j].save(fout);
+                    }
                 }
             }
-        }
 
-        /* End of set intersection */
+            /* End of set intersection */
 
-        /* Begin of decryption */
+            /* Begin of decryption */
         
-        cout << "Decrypting results..." << flush;
-        start = high_resolution_clock::now();
-        vector<vector<Ciphertext>> finals;
-        recrypt
-        (
-            finals, results, randoms, crt, receiver_eta, sender_encoder_ptr, sender_decryptor_ptr,
-            receiver_context_ptr, receiver_encoder_ptr, receiver_evaluator_ptr, receiver_relinkeys_ptr,
-            receiver_galoiskeys_ptr, num_threads
-        );
-        end = high_resolution_clock::now();
-        time_span = duration_cast<TimeUnit>(end - start).count();
-        cout << "done (" << time_span << " " << time_unit << ")" << endl;
-        time_sender += time_span;
-
-        // save finals
-        for (uint64_t i = 0; i < finals.size(); i++)
-        {
-            for (uint64_t j = 0; j < finals[i].size(); j++)
+            cout << "Decrypting results..." << flush;
+            start = high_resolution_clock::now();
+            vector<vector<Ciphertext>> finals;
+            recrypt
+            (
+                finals, results, randoms, crt, receiver_eta, receiver_plan, stash_size > 0, true, sender_encoder_ptr, sender_decryptor_ptr,
+                receiver_context_ptr, receiver_encoder_ptr, receiver_evaluator_ptr, receiver_relinkeys_ptr,
+                receiver_galoiskeys_ptr, nullptr, num_threads
+            );
+            end = high_resolution_clock::now();
+            time_span = duration_cast<TimeUnit>(end - start).count();
+            cout << "done (" << time_span << " " << time_unit << ")" << endl;
+            time_sender += time_span;
+
+            // save finals
+            for (uint64_t i = 0; i < finals.size(); i++)
             {
-                string filename = tag + "_E_" + to_string(i) + "_" + to_string(j) + ".tmp";
-                ofstream fout(filename);
-                finals[i][j].save(fout);
+                for (uint64_t j = 0; j < finals[i].size(); j++)
+                {
+                    string filename = tag + "_E_" + to_string(i) + "_" + to_string(j) + ".tmp";
+                    ofstream fout(filename);
+                    finals[i][j].save(fout);
+                }
             }
-        }
 
-        /* End of decryption */
+            /* End of decryption */
+
+            /* Begin of result */
 
-        /* Begin of result */
+            cout << "Decrypting intersection..." << flush;
+            start = high_resolution_clock::now();
+            auto intersection = decryptIntersection(finals, receiver, crt, receiver_encoder_ptr, receiver_decryptor_ptr, stash_repetitions, num_threads);
+            end = high_resolution_clock::now();
+            time_span = duration_cast<TimeUnit>(end - start).count();
+            cout << "done (" << time_span << " " << time_unit << ")" << endl;
+            time_receiver += time_span;
 
-        cout << "Decrypting intersection..." << flush;
-        start = high_resolution_clock::now();
-        auto intersection = decryptIntersection(finals, receiver, crt, receiver_encoder_ptr, receiver_decryptor_ptr, num_threads);
-        end = high_resolution_clock::now();
-        time_span = duration_cast<TimeUnit>(end - start).count();
-        cout << "done (" << time_span << " " << time_unit << ")" << endl;
-        time_receiver += time_span;
+            cout << "Intersection size: " << intersection.size() << endl;
+            if (check) checkIntersection(intersection, receiver, sender_values);
+            // cout << "Intersection:";
+            // for (auto & value : intersection) cout << " " << value;
+            // cout << endl;
 
-        cout << "Intersection size: " << intersection.size() << endl;
-        // cout << "Intersection:";
-        // for (auto & value : intersection) cout << " " << value;
-        // cout << endl;
+            /* End of result */
+        }
+    };
+    intersectAll(encrypted_table);
 
-        /* End of result */
+    // With the check, the Sender then updates its set as 'sender_update.cpp' does, and every set is intersected again:
+    // every other element found is erased, and the Receiver's elements outside the Sender's set are inserted
+    if (check)
+    {
+        // The Receiver keeps its copy of the table on disk, and patches it after the update with the ciphertexts
+        // whose digest changed, as 'sender_sync.cpp' and 'receiver_sync.cpp' do
+        const string receiver_filename = "../data/receiver/check";
+        saveTable(receiver_filename, cuckoo_params, encrypted_table);
+        TableVersion receiver_version;
+        receiver_version.params_digest = digest(cuckoo_params);
+        for (auto & ct : encrypted_table) receiver_version.digests.push_back(digest(ct));
+
+        cout << "Updating Cuckoo hash table..." << flush;
+        cuckoo.clearDirtyBins();
+        uint64_t num_erased = 0, num_inserted = 0, rehashes = cuckoo.getRehashes();
+        bool erase = true;
+        for (auto & receiver : receivers)
+        {
+            for (auto value : receiver.getSet())
+            {
+                if (!sender_values.count(value))
+                {
+                    cuckoo.insert(value, num_threads, max_rehashes);
+                    sender_values.insert(value);
+                    num_inserted++;
+                }
+                else
+                {
+                    if (erase)
+                    {
+                        num_erased += cuckoo.erase(value);
+                        sender_values.erase(value);
+                    }
+                    erase = !erase;
+                }
+            }
+        }
+        cout << "done." << endl;
+        cout << "Erased " << num_erased << " and inserted " << num_inserted << " elements" << endl;
+        cout << "Rehashed tables: " << cuckoo.getRehashes() - rehashes << endl;
+        cout << "Stash entries: " << cuckoo.getStash().size() << " of " << stash_size << endl;
+
+        // Re-encrypt the ciphertexts covering changed bins, and the stash ciphertexts if the stash changed
+        cout << "Encrypting changed ciphertexts..." << flush;
+        vector<uint64_t> indices;
+        for (auto bin : cuckoo.getDirtyBins())
+            if (indices.empty() || indices.back() != bin / sender_n) indices.push_back(bin / sender_n);
+        if (cuckoo.getDirtyStash())
+        {
+            uint64_t table_cts = cuckoo.getTableSize() / sender_n + bool(cuckoo.getTableSize() % sender_n);
+            for (uint64_t i = 0; i < stashLayout(cuckoo, crt, sender_n).num_chunks; i++) indices.push_back(table_cts + i);
+        }
+        encryptTable(encrypted_table, cuckoo, crt, sender_encoder_ptr, sender_encryptor_ptr, indices, num_threads);
+        switchTable(encrypted_table, cuckoo, crt, sender_encoder_ptr, sender_evaluator_ptr, table_level, indices, num_threads);
+        cuckoo_params = Kuckoo(cuckoo.getParameters()); // new hash functions if a table was rehashed
+        cout << "done." << endl;
+        cout << "Changed ciphertexts: " << indices.size() << " of " << encrypted_table.size() << endl;
+
+        // Patch the Receiver's copy, load it back, and check it against the Sender's table
+        cout << "Patching Receiver's table..." << flush;
+        vector<uint64_t> delta;
+        for (uint64_t i = 0; i < encrypted_table.size(); i++)
+            if ((i >= receiver_version.digests.size()) || (receiver_version.digests[i] != digest(encrypted_table[i]))) delta.push_back(i);
+        saveTable(receiver_filename, cuckoo_params, encrypted_table, delta);
+        vector<Ciphertext> receiver_table;
+        tie(cuckoo_params, receiver_table) = loadTable(receiver_filename, sender_context_ptr);
+        if (digest(cuckoo_params) != digest(cuckoo)) throw "Table patch check failed (parameters)";
+        if (receiver_table.size() != encrypted_table.size()) throw "Table patch check failed (size)";
+        for (uint64_t i = 0; i < encrypted_table.size(); i++)
+            if (digest(receiver_table[i]) != digest(encrypted_table[i])) throw "Table patch check failed (ciphertext " + to_string(i) + ")";
+        cout << "done." << endl;
+        cout << "Patched ciphertexts: " << delta.size() << " of " << receiver_table.size()
+             << (receiver_version.params_digest != digest(cuckoo) ? ", and the parameters" : "") << endl;
+
+        intersectAll(receiver_table);
     }
     // write time_sender and time_receiver to file
     {
@@ -287,6 +435,10 @@ try
     cerr << e.what() << endl;
     return 1;
 } catch (const char * e)
+{
+    cerr << e << endl;
+    return 1;
+} catch (const string & e)
 {
     cerr << e << endl;
     return 1;
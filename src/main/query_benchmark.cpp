@@ -0,0 +1,152 @@
+// Benchmark of the query plaintexts
+// Compares QueryEncoder::encode, encodeOffset and encodeOffset with addOffset against packEncode, which runs the full
+// BatchEncoder::encode, on random runs of slots, with the number of plaintexts that differ from packEncode's
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bfv.h"
+#include "crt.h"
+#include "io.h"
+#include "packing.h"
+#include "random.h"
+#include "seal/seal.h"
+
+using namespace fhe;
+using namespace math;
+using namespace seal;
+using namespace std;
+using namespace std::chrono;
+
+// one run of slots that holds 'value' in CRT component 'component'
+struct Run
+{
+    uint64_t slot;
+    uint64_t component;
+    uint64_t value;
+};
+
+// whether the first n coefficients of a and b match, with missing coefficients read as 0
+static bool equal(const Plaintext & a, const Plaintext & b, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        uint64_t ai = i < a.coeff_count() ? a[i] : 0;
+        uint64_t bi = i < b.coeff_count() ? b[i] : 0;
+        if (ai != bi) return false;
+    }
+    return true;
+}
+
+int main(int argc, char * argv[])
+try
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " <ti> <bin widths> <runs> <repetitions>" << endl;
+        cerr << "ti: comma-separated plaintext moduli, as in the parameter files (e.g. 40961,65537)" << endl;
+        cerr << "bin widths: comma-separated numbers of slots per run (default: 1,2,4)" << endl;
+        cerr << "runs: number of runs in the plaintexts of encodeOffset with addOffset (default: 4)" << endl;
+        cerr << "repetitions: number of random plaintexts per bin width (default: 100)" << endl;
+        return 1;
+    }
+    vector<uint64_t> ti, bin_widths;
+    for (auto & t : io::split(argv[1], ',')) ti.push_back(stoull(t));
+    for (auto & w : io::split(argc > 2 ? argv[2] : "1,2,4", ',')) bin_widths.push_back(stoull(w));
+    uint64_t num_runs = argc > 3 ? stoull(argv[3]) : 4;
+    uint64_t repetitions = argc > 4 ? stoull(argv[4]) : 100;
+
+    // parameters of 'protocol.cpp'
+    uint64_t n = 1 << 12; vector<int> logqi{27, 27, 27, 28};
+    auto context_ptr = instantiateEncryptionScheme(n, logqi, ti);
+    auto [encoder_ptr, evaluator_ptr] = generateEvaluator(context_ptr);
+    auto crt = crtParams(ti);
+    const uint64_t k = crt.mi.size();
+    uint64_t mi_min = crt.mi[0];
+    for (auto mi : crt.mi) mi_min = min(mi_min, mi);
+    cout << "M: " << crt.M << ", k: " << k << ", runs: " << num_runs << ", repetitions: " << repetitions << endl;
+
+    uint64_t total_errors = 0;
+    for (auto bin_width : bin_widths)
+    {
+        if (!bin_width || n % bin_width) throw "The bin width must divide " + to_string(n);
+        const uint64_t num_bins = n / bin_width;
+
+        // random fill and runs in distinct bins, as the queries of one ciphertext
+        uint64_t fill = generator().uniform(0, mi_min - 1);
+        QueryEncoder query_encoder(crt, encoder_ptr, fill);
+        vector<vector<Run>> queries(repetitions);
+        for (auto & runs : queries)
+        {
+            vector<bool> used(num_bins, false);
+            while (runs.size() < min(num_runs, num_bins))
+            {
+                uint64_t bin = generator().uniform(0, num_bins - 1);
+                if (used[bin]) continue;
+                used[bin] = true;
+                uint64_t component = generator().uniform(0, k - 1);
+                runs.push_back({bin * bin_width, component, generator().uniform(0, crt.mi[component] - 1)});
+            }
+        }
+
+        // the reference: every slot of the plaintext goes through the CRT packing and the full batch encode
+        auto reference = [&](const vector<Run> & runs, uint64_t count, Plaintext & pt)
+        {
+            vector<uint64_t> vs(k * n, fill);
+            for (uint64_t r = 0; r < count; r++)
+                for (uint64_t s = runs[r].slot; s < runs[r].slot + bin_width; s++) vs[s*k + runs[r].component] = runs[r].value;
+            packEncode(pt, vs, crt, encoder_ptr);
+        };
+        // the reference minus the all-fill plaintext
+        const auto & fill_pt = query_encoder.fillPlaintext();
+        auto offset = [&](Plaintext & pt)
+        {
+            pt.resize(n);
+            for (uint64_t i = 0; i < n; i++)
+            {
+                uint64_t f = i < fill_pt.coeff_count() ? fill_pt[i] : 0;
+                pt[i] = pt[i] >= f ? pt[i] - f : pt[i] + crt.M - f;
+            }
+        };
+
+        vector<Plaintext> expected(repetitions), expected_offset(repetitions), expected_runs(repetitions), pts(repetitions);
+        for (uint64_t r = 0; r < repetitions; r++)
+        {
+            reference(queries[r], 1, expected[r]);
+            expected_offset[r] = expected[r];
+            offset(expected_offset[r]);
+            reference(queries[r], queries[r].size(), expected_runs[r]);
+            offset(expected_runs[r]);
+        }
+
+        auto time = [&](const string & name, const vector<Plaintext> & expected_pts, auto encode)
+        {
+            auto start = high_resolution_clock::now();
+            for (uint64_t r = 0; r < repetitions; r++) encode(queries[r], pts[r]);
+            auto end = high_resolution_clock::now();
+            double us = duration_cast<nanoseconds>(end - start).count() / 1000.0 / repetitions;
+            uint64_t errors = 0;
+            for (uint64_t r = 0; r < repetitions; r++) errors += !equal(pts[r], expected_pts[r], n);
+            total_errors += errors;
+            cout << "bin width " << bin_width << ", " << name << ": " << us << " us/plaintext, " << errors << " wrong plaintexts" << endl;
+        };
+
+        time("packEncode", expected, [&](const vector<Run> & runs, Plaintext & pt) { reference(runs, 1, pt); });
+        time("encode", expected, [&](const vector<Run> & runs, Plaintext & pt)
+            { query_encoder.encode(pt, runs[0].slot, bin_width, runs[0].component, runs[0].value); });
+        time("encodeOffset", expected_offset, [&](const vector<Run> & runs, Plaintext & pt)
+            { query_encoder.encodeOffset(pt, runs[0].slot, bin_width, runs[0].component, runs[0].value); });
+        time("encodeOffset + addOffset", expected_runs, [&](const vector<Run> & runs, Plaintext & pt)
+        {
+            query_encoder.encodeOffset(pt, runs[0].slot, bin_width, runs[0].component, runs[0].value);
+            for (uint64_t q = 1; q < runs.size(); q++) query_encoder.addOffset(pt, runs[q].slot, bin_width, runs[q].component, runs[q].value);
+        });
+    }
+    return total_errors ? 1 : 0;
+}
+catch (const exception & e) { cerr << e.what() << endl; return 1; }
+catch (const char * e) { cerr << e << endl; return 1; }
+catch (const string & e) { cerr << e << endl; return 1; }
+catch (...) { cerr << "Unknown exception" << endl; return 1; }
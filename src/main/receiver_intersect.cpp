@@ -13,6 +13,7 @@
 #include "psi.h"
 #include "seal/seal.h"
 #include "socket.h"
+#include "stash.h"
 
 using namespace fhe;
 using namespace io;
@@ -39,6 +40,7 @@ try
     cout << "Receiver parameters:" << endl << receiver << endl;
     cout << "Set parameters:" << endl << set << endl;
     cout << "Table parameters:" << endl << table << endl;
+    if (compute.multi_query && sender.n != receiver.n) throw "Multi-query packing needs the same n for Sender and Receiver";
 
     time_point<high_resolution_clock> start, end;
     uint64_t time_span;
@@ -111,12 +113,73 @@ try
     // Load Cuckoo hash table
     cout << "Loading Cuckoo hash table..." << flush;
     start = high_resolution_clock::now();
-    auto [cuckoo, encrypted_table] = loadTable(table.filename, sender_context_ptr);
+    auto [cuckoo, encrypted_table] = loadTable(table.filename, sender_context_ptr, {});
     uint64_t receiver_dummy = get<3>(cuckoo.getParameters()) + 2;
+    uint64_t stash_repetitions = stashLayout(cuckoo, crt, sender.n).repetitions;
+    auto version = loadVersion(table.filename);
+    auto stale = loadPresubtracted(table.filename, sender_context_ptr, encrypted_table, receiver_dummy, version);
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
     time_io_all += time_span;
+    if (version.level) cout << "Table level: " << version.level << " primes" << endl;
+
+    // Subtract the dummy plaintext from the table ciphertexts not in the cache yet
+    cout << "Pre-subtracting " << stale.size() << " of " << encrypted_table.size() << " ciphertexts..." << flush;
+    start = high_resolution_clock::now();
+    presubtractTable(encrypted_table, cuckoo, crt, sender_encoder_ptr, sender_evaluator_ptr, receiver_dummy, stale, compute.num_threads);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_compute_all += time_span;
+
+    // Save the new cache entries
+    if (!stale.empty())
+    {
+        cout << "Saving pre-subtracted table..." << flush;
+        start = high_resolution_clock::now();
+        savePresubtracted(table.filename, encrypted_table, receiver_dummy, version, stale);
+        end = high_resolution_clock::now();
+        time_span = duration_cast<TimeUnit>(end - start).count();
+        cout << "done (" << time_span << " " << time_unit << ")" << endl;
+        time_io_all += time_span;
+    }
+
+    // Plan the levels of the product of each partition
+    cout << "Planning product levels..." << flush;
+    start = high_resolution_clock::now();
+    const uint64_t num_hashes = cuckoo.getNumHashes();
+    auto sender_product = planProduct
+    (
+        sender_context_ptr, num_hashes / (sender.eta + 1) + bool(num_hashes % (sender.eta + 1)), sender.product, sender.level_aware, false,
+        levelOfPrimes(sender_context_ptr, version.level) // the level Sender stored the table at
+    );
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ", primes per tree level: " << levelsName(sender_product, sender_context_ptr) << ")" << endl;
+    time_compute_all += time_span;
+
+    // Load the masks left by the previous run and precompute the rest
+    MaskPool masks(compute.mask_pool_depth);
+    const string masks_filename = table.filename + ".masks";
+    if (compute.mask_pool_depth)
+    {
+        cout << "Loading mask pool..." << flush;
+        start = high_resolution_clock::now();
+        masks.load(masks_filename, crt, sender_context_ptr, receiver_context_ptr);
+        end = high_resolution_clock::now();
+        time_span = duration_cast<TimeUnit>(end - start).count();
+        cout << "done (" << time_span << " " << time_unit << ")" << endl;
+        time_io_all += time_span;
+
+        cout << "Filling mask pool with " << compute.mask_pool_depth - masks.size() << " masks..." << flush;
+        start = high_resolution_clock::now();
+        masks.fill(maskMaker(crt, sender_encoder_ptr, receiver_encoder_ptr, receiver_encryptor_ptr), compute.num_threads);
+        end = high_resolution_clock::now();
+        time_span = duration_cast<TimeUnit>(end - start).count();
+        cout << "done (" << time_span << " " << time_unit << ")" << endl;
+        time_compute_all += time_span;
+    }
 
     // Connect to Sender
     cout << "Connecting to Sender..." << flush;
@@ -145,7 +208,7 @@ try
     const uint64_t & num_sets = set.filenames.size();
     {
         stringstream ss;
-        ss << num_sets;
+        ss << num_sets << ' ' << compute.multi_query;
         socket.send(ss);
     }
     cout << "done" << endl;
@@ -170,20 +233,35 @@ try
         cout << "done (" << time_span << " " << time_unit << ")" << endl;
         time_io_one += time_span;
 
-        // Compute intersection
+        // Compute intersection, with the masks made so far
+        masks.stop();
+        masks.resetWatermark();
         cout << "Computing intersection..." << flush;
         start = high_resolution_clock::now();
         vector<vector<Ciphertext>> results, randoms;
-        computeIntersection
+        QueryPlan plan;
+        if (compute.multi_query)
+        {
+            plan = planQueries(party, cuckoo, crt, sender.n);
+            computeIntersection
+            (
+                results, randoms, plan, cuckoo, encrypted_table, true, crt, sender.eta, sender_product,
+                sender_context_ptr, sender_encoder_ptr, sender_evaluator_ptr, sender_relinkeys_ptr,
+                receiver_encoder_ptr, receiver_encryptor_ptr, receiver_dummy, &masks, compute.num_threads
+            );
+        }
+        else computeIntersection
         (
-            results, randoms, party, cuckoo, encrypted_table, crt, sender.eta,
+            results, randoms, party, cuckoo, encrypted_table, true, crt, sender.eta, sender_product,
             sender_context_ptr, sender_encoder_ptr, sender_evaluator_ptr, sender_relinkeys_ptr,
-            receiver_encoder_ptr, receiver_encryptor_ptr, receiver_dummy, compute.num_threads
+            receiver_encoder_ptr, receiver_encryptor_ptr, receiver_dummy, &masks, compute.num_threads
         );
         end = high_resolution_clock::now();
         time_span = duration_cast<TimeUnit>(end - start).count();
         cout << "done (" << time_span << " " << time_unit << ")" << endl;
         time_compute_one += time_span;
+        if (compute.multi_query) cout << "Query rounds: " << plan.rounds.size() << ", result rows: " << results.size() << " for " << party.getSet().size() << " elements" << endl;
+        if (compute.mask_pool_depth) cout << "Mask pool: low watermark " << masks.getLowWatermark() << " of " << masks.getDepth() << ", " << masks.getMisses() << " masks made online" << endl;
 
         // Send intermediate results to Sender
         cout << "Sending intermediate results to Sender..." << flush;
@@ -195,6 +273,9 @@ try
         cout << "done (" << time_span << " " << time_unit << ")" << endl;
         time_network_one += time_span;
 
+        // Refill the mask pool while the Sender recrypts and until the next set
+        if (compute.mask_pool_depth) masks.start(maskMaker(crt, sender_encoder_ptr, receiver_encoder_ptr, receiver_encryptor_ptr), compute.num_threads);
+
         // Receive final results from Sender
         cout << "Receiving final results from Sender..." << flush;
         start = high_resolution_clock::now();
@@ -207,7 +288,9 @@ try
         // Decrypt results
         cout << "Decrypting intersection..." << flush;
         start = high_resolution_clock::now();
-        auto intersection = decryptIntersection(finals, party, crt, receiver_encoder_ptr, receiver_decryptor_ptr, compute.num_threads);
+        auto intersection = compute.multi_query
+            ? decryptIntersection(finals, plan, party, crt, receiver_encoder_ptr, receiver_decryptor_ptr, compute.num_threads)
+            : decryptIntersection(finals, party, crt, receiver_encoder_ptr, receiver_decryptor_ptr, stash_repetitions, compute.num_threads);
         end = high_resolution_clock::now();
         time_span = duration_cast<TimeUnit>(end - start).count();
         cout << "done (" << time_span << " " << time_unit << ")" << endl;
@@ -235,6 +318,19 @@ try
         time_io_all += time_io_one;
     }
 
+    // Save the masks left for the next run
+    if (compute.mask_pool_depth)
+    {
+        masks.stop();
+        cout << endl << "Saving " << masks.size() << " masks..." << flush;
+        start = high_resolution_clock::now();
+        masks.save(masks_filename, crt);
+        end = high_resolution_clock::now();
+        time_span = duration_cast<TimeUnit>(end - start).count();
+        cout << "done (" << time_span << " " << time_unit << ")" << endl;
+        time_io_all += time_span;
+    }
+
     // Show total times
     cout << endl;
     showTimes("Total", "compute", time_compute_all, time_unit);
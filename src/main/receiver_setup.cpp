@@ -1,4 +1,5 @@
 #include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <exception>
 #include <string>
@@ -68,6 +69,7 @@ try
     saveSecretKey(receiver.filename_sk, receiver_secret_key_ptr);
     saveRelinKeys(receiver.filename_rk, receiver_relinkeys_ptr);
     saveGaloisKeys(receiver.filename_gk, receiver_galoiskeys_ptr);
+    remove((table.filename + ".masks").c_str()); // precomputed masks are encrypted under the previous key
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
@@ -118,6 +120,7 @@ try
     cout << "Receiving Cuckoo hash table from Sender..." << flush;
     start = high_resolution_clock::now();
     auto [cuckoo, encrypted_table] = receiveTable(socket, sender_context_ptr);
+    auto version = receiveVersion(socket);
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
@@ -127,6 +130,7 @@ try
     cout << "Saving Cuckoo hash table..." << flush;
     start = high_resolution_clock::now();
     saveTable(table.filename, cuckoo, encrypted_table);
+    saveVersion(table.filename, version);
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
@@ -0,0 +1,99 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bfv.h"
+#include "crypto_io.h"
+#include "crypto_network.h"
+#include "io.h"
+#include "seal/seal.h"
+#include "socket.h"
+
+using namespace fhe;
+using namespace io;
+using namespace network;
+using namespace seal;
+using namespace std;
+using namespace std::chrono;
+
+using TimeUnit = milliseconds;
+const string time_unit = "ms";
+
+int main(int argc, char * argv[])
+try
+{
+    auto [success, compute, sender, receiver, set, table] = processInput(argc, argv);
+    if (!success) { usageMessage(argv); return 1; }
+
+    cout << "Receiver's Table Synchronization" << endl << endl;
+
+    cout << "Compute parameters:" << endl << compute << endl;
+    cout << "Sender parameters:" << endl << sender << endl;
+    cout << "Table parameters:" << endl << table << endl;
+
+    time_point<high_resolution_clock> start, end;
+    uint64_t time_span;
+    uint64_t time_network, time_io;
+    time_network = time_io = 0;
+
+    // Load table version and parameters
+    cout << "Loading table version..." << flush;
+    start = high_resolution_clock::now();
+    auto sender_context_ptr = instantiateEncryptionScheme(sender.n, sender.logqi, sender.ti);
+    auto version = loadVersion(table.filename);
+    auto [cuckoo, encrypted_table] = loadTable(table.filename, sender_context_ptr, {});
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_io += time_span;
+    cout << "Table version: " << version.version << endl;
+
+    // Connect to Sender
+    cout << "Connecting to Sender..." << flush;
+    start = high_resolution_clock::now();
+    Socket socket(compute.port_setup, compute.rcvbuf_size, compute.sndbuf_size);
+    socket.connect(compute.ip.c_str());
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_network += time_span;
+
+    // Send table version to Sender
+    cout << "Sending table version to Sender..." << flush;
+    start = high_resolution_clock::now();
+    sendVersion(socket, version);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_network += time_span;
+
+    // Receive changes from Sender
+    cout << "Receiving table changes from Sender..." << flush;
+    start = high_resolution_clock::now();
+    auto indices = receiveTableDelta(socket, sender_context_ptr, cuckoo, encrypted_table, version);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_network += time_span;
+    cout << "Changed ciphertexts: " << indices.size() << " of " << encrypted_table.size() << endl;
+
+    // Patch Cuckoo hash table on disk
+    cout << "Saving table changes..." << flush;
+    start = high_resolution_clock::now();
+    saveTable(table.filename, cuckoo, encrypted_table, indices);
+    saveVersion(table.filename, version);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_io += time_span;
+    cout << "Table version: " << version.version << endl;
+
+    // Show total time
+    cout << endl;
+    cout << "Total time (network): " << time_network << " " << time_unit << endl;
+    cout << "Total time (I/O): " << time_io << " " << time_unit << endl;
+}
+catch (const exception & e) { cerr << e.what() << endl; return 1; }
+catch (const char * e) { cerr << e << endl; return 1; }
+catch (const string & e) { cerr << e << endl; return 1; }
+catch (...) { cerr << "Unknown exception" << endl; return 1; }
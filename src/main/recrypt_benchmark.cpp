@@ -0,0 +1,118 @@
+// Benchmark of the Sender's online phase (recrypt) as the number of threads grows
+// Uses the parameters of 'protocol.cpp' and random results, since recrypt does not depend on their values
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bfv.h"
+#include "crt.h"
+#include "product.h"
+#include "psi.h"
+#include "random.h"
+#include "seal/seal.h"
+
+using namespace fhe;
+using namespace math;
+using namespace psi;
+using namespace seal;
+using namespace std;
+using namespace std::chrono;
+
+int main(int argc, char * argv[])
+try
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " <mode> <|Y|> <threads> <repetitions> <product> <level_aware>" << endl;
+        cerr << "mode: 0 (Fast Setup), 1 (Fast Intersection)" << endl;
+        cerr << "|Y|: size of the Receiver's set (default: 64)" << endl;
+        cerr << "threads: largest number of threads, measured from 1 in powers of 2 (default: hardware threads)" << endl;
+        cerr << "repetitions: number of repetitions per number of threads (default: 3)" << endl;
+        cerr << "product: multiply_many, tree or lazy (default: multiply_many)" << endl;
+        cerr << "level_aware: 1 to switch the tree levels of the product down to the lowest safe modulus (default: 0)" << endl;
+        return 1;
+    }
+    bool mode = stoi(argv[1]);
+    uint64_t sizeY = argc > 2 ? stoull(argv[2]) : 64;
+    uint64_t max_threads = max<uint64_t>(1, argc > 3 ? stoull(argv[3]) : thread::hardware_concurrency());
+    uint64_t repetitions = argc > 4 ? stoull(argv[4]) : 3;
+    Product method = argc > 5 ? parseProduct(argv[5]) : Product::multiply_many;
+    bool level_aware = argc > 6 ? stoi(argv[6]) : false;
+
+    // parameters of 'protocol.cpp'
+    uint64_t n = 1 << 12; vector<int> logqi{27, 27, 27, 28};
+    auto ti = mode ? vector<uint64_t>{40961} : vector<uint64_t>{40961, 65537};
+    auto crt = crtParams(ti);
+    uint64_t sender_eta = mode ? 0 : 1;
+    uint64_t receiver_eta = mode ? 0 : 1;
+
+    cout << "Generating keys..." << flush;
+    SEALContext* sender_context_ptr;
+    do { sender_context_ptr = instantiateEncryptionScheme(n, logqi, ti); }
+    while (!validKeys(sender_context_ptr));
+    auto [sender_secret_key_ptr, sender_relinkeys_ptr, sender_galoiskeys_ptr] = generateKeys(sender_context_ptr, false);
+    auto [sender_encoder_ptr, sender_evaluator_ptr] = generateEvaluator(sender_context_ptr);
+    auto sender_encryptor_ptr = new Encryptor(*sender_context_ptr, *sender_secret_key_ptr);
+    auto sender_decryptor_ptr = new Decryptor(*sender_context_ptr, *sender_secret_key_ptr);
+
+    SEALContext* receiver_context_ptr;
+    do { receiver_context_ptr = instantiateEncryptionScheme(n, logqi, ti); }
+    while (!validKeys(receiver_context_ptr));
+    auto [receiver_secret_key_ptr, receiver_relinkeys_ptr, receiver_galoiskeys_ptr] = generateKeys(receiver_context_ptr);
+    auto [receiver_encoder_ptr, receiver_evaluator_ptr] = generateEvaluator(receiver_context_ptr);
+    auto receiver_encryptor_ptr = new Encryptor(*receiver_context_ptr, *receiver_secret_key_ptr);
+    auto product = planProduct
+    (
+        receiver_context_ptr, (sender_eta + 1) / (receiver_eta + 1) + bool((sender_eta + 1) % (receiver_eta + 1)), method, level_aware, true,
+        receiver_context_ptr->first_parms_id()
+    );
+    cout << "done (primes per tree level: " << levelsName(product, receiver_context_ptr) << ")." << endl;
+
+    // results as computeIntersection returns them: mod-switched under Sender's key, with random masks under Receiver's key
+    cout << "Encrypting " << sizeY << " x " << sender_eta + 1 << " results..." << flush;
+    vector<vector<Ciphertext>> results(sizeY, vector<Ciphertext>(sender_eta + 1)), randoms = results;
+    for (uint64_t i = 0; i < sizeY; i++)
+    {
+        for (uint64_t j = 0; j <= sender_eta; j++)
+        {
+            Plaintext pt;
+            sender_encoder_ptr->encode(randomVector(n, 0, crt.M - 1), pt);
+            sender_encryptor_ptr->encrypt_symmetric(pt, results[i][j]);
+            sender_evaluator_ptr->mod_switch_to_inplace(results[i][j], sender_context_ptr->last_parms_id());
+            receiver_encoder_ptr->encode(randomVector(n, 0, crt.M - 1), pt);
+            receiver_encryptor_ptr->encrypt_symmetric(pt, randoms[i][j]);
+        }
+    }
+    cout << "done." << endl;
+
+    double time_single = 0;
+    for (uint64_t num_threads = 1; ; num_threads = min(2 * num_threads, max_threads))
+    {
+        double best = 0;
+        for (uint64_t r = 0; r < repetitions; r++)
+        {
+            vector<vector<Ciphertext>> finals;
+            auto start = high_resolution_clock::now();
+            recrypt
+            (
+                finals, results, randoms, crt, receiver_eta, product, false, true, sender_encoder_ptr, sender_decryptor_ptr,
+                receiver_context_ptr, receiver_encoder_ptr, receiver_evaluator_ptr, receiver_relinkeys_ptr,
+                receiver_galoiskeys_ptr, nullptr, num_threads
+            );
+            auto end = high_resolution_clock::now();
+            double time = duration_cast<microseconds>(end - start).count() / 1000.0;
+            best = r ? min(best, time) : time;
+        }
+        if (num_threads == 1) time_single = best;
+        cout << "threads: " << num_threads << ", recrypt: " << best << " ms, speedup: " << time_single / best << endl;
+        if (num_threads == max_threads) break;
+    }
+}
+catch (const exception & e) { cerr << e.what() << endl; return 1; }
+catch (const char * e) { cerr << e << endl; return 1; }
+catch (const string & e) { cerr << e << endl; return 1; }
+catch (...) { cerr << "Unknown exception" << endl; return 1; }
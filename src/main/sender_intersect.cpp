@@ -10,6 +10,7 @@
 #include "psi.h"
 #include "seal/seal.h"
 #include "socket.h"
+#include "stash.h"
 
 using namespace fhe;
 using namespace math;
@@ -107,6 +108,42 @@ try
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
     time_compute_all += time_span;
 
+    // Plan the levels of the product of each partition of the results
+    cout << "Planning product levels..." << flush;
+    start = high_resolution_clock::now();
+    auto receiver_product = planProduct
+    (
+        receiver_context_ptr, (sender.eta + 1) / (receiver.eta + 1) + bool((sender.eta + 1) % (receiver.eta + 1)), receiver.product, receiver.level_aware, true,
+        receiver_context_ptr->first_parms_id()
+    );
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ", primes per tree level: " << levelsName(receiver_product, receiver_context_ptr) << ")" << endl;
+    time_compute_all += time_span;
+
+    // Load table parameters, which decide whether the Receiver appends the stash check to each row
+    cout << "Loading table parameters..." << flush;
+    start = high_resolution_clock::now();
+    auto cuckoo = loadTableParameters(table.filename);
+    const uint64_t result_width = sender.eta + 1 + bool(stashLayout(cuckoo, crt, sender.n).size);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_io_all += time_span;
+
+    // Precompute recrypt masks and rotations
+    RecryptPool masks(compute.mask_pool_depth);
+    if (compute.mask_pool_depth)
+    {
+        cout << "Filling recrypt pool with " << compute.mask_pool_depth << " masks..." << flush;
+        start = high_resolution_clock::now();
+        masks.fill(recryptMaskMaker(crt, receiver_encoder_ptr), compute.num_threads);
+        end = high_resolution_clock::now();
+        time_span = duration_cast<TimeUnit>(end - start).count();
+        cout << "done (" << time_span << " " << time_unit << ")" << endl;
+        time_compute_all += time_span;
+    }
+
     // Wait for Receiver to connect
     cout << "Waiting for Receiver to connect..." << flush;
     Socket socket(compute.port_intersect, compute.rcvbuf_size, compute.sndbuf_size);
@@ -125,11 +162,17 @@ try
 
     cout << endl << "Recurrent costs" << endl << endl;
 
-    // Receive the number of Receiver's sets so the program can terminate
+    // Receive the number of Receiver's sets so the program can terminate, and whether it packs its queries
     cout << "Receiving the number of Receiver's sets..." << flush;
     uint64_t num_sets;
-    socket.receive() >> num_sets;
+    bool multi_query = false;
+    {
+        auto ss = socket.receive();
+        ss >> num_sets >> multi_query;
+    }
     cout << "done." << endl;
+    // unrotated results show the Receiver where each match sits in the table, so only the Sender can agree to it
+    if (multi_query && !compute.allow_multi_query) throw "Receiver requested multi-query packing, which allow_multi_query does not permit";
 
     // For each Receiver's set
     for (uint64_t set_number=1; set_number<=num_sets; set_number++)
@@ -149,20 +192,28 @@ try
         cout << "done (" << time_span << " " << time_unit << ")" << endl;
         time_network_one += time_span;
 
-        // Decrypt intermediate results
+        // Decrypt intermediate results, with the masks made so far
+        masks.stop();
+        masks.resetWatermark();
         cout << "Decrypting intermediate results..." << flush;
         start = high_resolution_clock::now();
         vector<vector<Ciphertext>> finals;
+        if (randoms.size() != results.size()) throw "Intermediate results do not match the table parameters";
+        for (uint64_t i = 0; i < results.size(); i++)
+            if ((results[i].size() != result_width) || (randoms[i].size() != result_width))
+                throw "Intermediate results do not match the table parameters";
+        bool stash = result_width > sender.eta + 1; // Receiver appends the stash check
         recrypt
         (
-            finals, results, randoms, crt, receiver.eta, sender_encoder_ptr, sender_decryptor_ptr,
+            finals, results, randoms, crt, receiver.eta, receiver_product, stash, !multi_query, sender_encoder_ptr, sender_decryptor_ptr,
             receiver_context_ptr, receiver_encoder_ptr, receiver_evaluator_ptr, receiver_relinkeys_ptr,
-            receiver_galoiskeys_ptr, compute.num_threads
+            receiver_galoiskeys_ptr, &masks, compute.num_threads
         );
         end = high_resolution_clock::now();
         time_span = duration_cast<TimeUnit>(end - start).count();
         cout << "done (" << time_span << " " << time_unit << ")" << endl;
         time_compute_one += time_span;
+        if (compute.mask_pool_depth) cout << "Recrypt pool: low watermark " << masks.getLowWatermark() << " of " << masks.getDepth() << ", " << masks.getMisses() << " masks made online" << endl;
 
         // Send final results to Receiver
         cout << "Sending final results to Receiver..." << flush;
@@ -173,6 +224,9 @@ try
         cout << "done (" << time_span << " " << time_unit << ")" << endl;
         time_network_one += time_span;
 
+        // Refill the recrypt pool until the next set arrives
+        if (compute.mask_pool_depth && set_number < num_sets) masks.start(recryptMaskMaker(crt, receiver_encoder_ptr), compute.num_threads);
+
         // Show intersection times
         cout << endl;
         auto set_name = "Set #" + to_string(set_number);
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <exception>
@@ -11,8 +12,8 @@
 #include "crypto_network.h"
 #include "kuckoo.h"
 #include "io.h"
-#include "packing.h"
 #include "party.h"
+#include "psi.h"
 #include "seal/seal.h"
 #include "socket.h"
 
@@ -100,12 +101,17 @@ try
     // k-table Cuckoo hashing
     cout << "Generating Cuckoo hash table..." << flush;
     start = high_resolution_clock::now();
-    Kuckoo cuckoo(table.num_hashes, table.table_size, table.max_data, table.max_depth, table.num_tables);
-    cuckoo.insert(party.getSet());
+    Kuckoo cuckoo(table.num_hashes, table.table_size, table.max_data, table.max_depth, table.num_tables, table.stash_size, table.bin_width);
+    if (get<3>(cuckoo.getParameters()) + 2 >= *min_element(sender.ti.begin(), sender.ti.end())) throw "Table values do not fit in the plaintext modulus";
+    cuckoo.setInsertion(table.insertion);
+    cuckoo.insert(party.getSet(), compute.num_threads, table.max_rehashes);
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
     time_compute_off += time_span;
+    cout << "Stash entries: " << cuckoo.getStash().size() << " of " << cuckoo.getStashSize() << endl;
+    cout << "Evictions per insert: " << double(cuckoo.getEvictions()) / party.getSet().size() << endl;
+    cout << "Rehashed tables: " << cuckoo.getRehashes() << endl;
 
     // Encode and Encrypt Cuckoo hash table
     cout << "Encrypting Cuckoo hash table..." << flush;
@@ -113,16 +119,41 @@ try
     auto sender_encoder_ptr = new BatchEncoder(*sender_context_ptr);
     auto sender_encryptor_ptr = new Encryptor(*sender_context_ptr, *sender_secret_key_ptr);
     vector<Ciphertext> encrypted_table;
-    packEncrypt(encrypted_table, cuckoo.getTable(), crt, sender_encoder_ptr, sender_encryptor_ptr, compute.num_threads);
+    encryptTable(encrypted_table, cuckoo, crt, sender_encoder_ptr, sender_encryptor_ptr, compute.num_threads);
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
     time_compute_off += time_span;
 
+    // Switch the table down to the lowest level the Receiver's product can start from
+    TableVersion version;
+    if (sender.level_aware)
+    {
+        cout << "Switching Cuckoo hash table to the lowest level..." << flush;
+        start = high_resolution_clock::now();
+        const uint64_t num_operands = table.num_hashes / (sender.eta + 1) + bool(table.num_hashes % (sender.eta + 1));
+        auto level = planOperandLevel(sender_context_ptr, num_operands, sender.product);
+        auto sender_evaluator_ptr = new Evaluator(*sender_context_ptr);
+        vector<uint64_t> indices(encrypted_table.size());
+        for (uint64_t i=0; i<indices.size(); i++) indices[i] = i;
+        switchTable(encrypted_table, cuckoo, crt, sender_encoder_ptr, sender_evaluator_ptr, level, indices, compute.num_threads);
+        version.level = sender_context_ptr->get_context_data(level)->parms().coeff_modulus().size();
+        end = high_resolution_clock::now();
+        time_span = duration_cast<TimeUnit>(end - start).count();
+        cout << "done (" << time_span << " " << time_unit << ", " << version.level << " primes)" << endl;
+        time_compute_off += time_span;
+    }
+
     // Save Cuckoo hash table
     cout << "Saving Cuckoo hash table..." << flush;
     start = high_resolution_clock::now();
     saveTable(table.filename, cuckoo, encrypted_table);
+    cuckoo.clearDirtyBins();
+    saveCuckoo(table.filename, cuckoo); // plaintext table for sender_update
+    version.version = 1;
+    version.params_digest = digest(cuckoo);
+    for (auto & ct : encrypted_table) version.digests.push_back(digest(ct));
+    saveVersion(table.filename, version);
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
@@ -160,6 +191,7 @@ try
     cout << "Sending Cuckoo hash table to Receiver..." << flush;
     start = high_resolution_clock::now();
     sendTable(socket, cuckoo, encrypted_table);
+    sendVersion(socket, version);
     end = high_resolution_clock::now();
     time_span = duration_cast<TimeUnit>(end - start).count();
     cout << "done (" << time_span << " " << time_unit << ")" << endl;
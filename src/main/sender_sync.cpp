@@ -0,0 +1,106 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bfv.h"
+#include "crypto_io.h"
+#include "crypto_network.h"
+#include "io.h"
+#include "seal/seal.h"
+#include "socket.h"
+
+using namespace fhe;
+using namespace io;
+using namespace network;
+using namespace seal;
+using namespace std;
+using namespace std::chrono;
+
+using TimeUnit = milliseconds;
+const string time_unit = "ms";
+
+int main(int argc, char * argv[])
+try
+{
+    auto [success, compute, sender, receiver, set, table] = processInput(argc, argv);
+    if (!success) { usageMessage(argv); return 1; }
+
+    cout << "Sender's Table Synchronization" << endl << endl;
+
+    cout << "Compute parameters:" << endl << compute << endl;
+    cout << "Sender parameters:" << endl << sender << endl;
+    cout << "Table parameters:" << endl << table << endl;
+
+    time_point<high_resolution_clock> start, end;
+    uint64_t time_span;
+    uint64_t time_compute, time_network, time_io;
+    time_compute = time_network = time_io = 0;
+
+    // Load table version
+    cout << "Loading table version..." << flush;
+    start = high_resolution_clock::now();
+    auto sender_context_ptr = instantiateEncryptionScheme(sender.n, sender.logqi, sender.ti);
+    auto version = loadVersion(table.filename);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_io += time_span;
+    cout << "Table version: " << version.version << endl;
+
+    // Wait for Receiver to connect
+    cout << "Waiting for Receiver to connect..." << flush;
+    Socket socket(compute.port_setup, compute.rcvbuf_size, compute.sndbuf_size);
+    socket.open();
+    cout << "done." << endl;
+
+    // Receive Receiver's table version
+    cout << "Receiving Receiver's table version..." << flush;
+    start = high_resolution_clock::now();
+    auto receiver_version = receiveVersion(socket);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_network += time_span;
+    cout << "Receiver's table version: " << receiver_version.version << endl;
+
+    // Find the ciphertexts the Receiver does not have
+    cout << "Comparing table versions..." << flush;
+    start = high_resolution_clock::now();
+    vector<uint64_t> indices;
+    for (uint64_t i = 0; i < version.digests.size(); i++)
+        if ((i >= receiver_version.digests.size()) || (receiver_version.digests[i] != version.digests[i])) indices.push_back(i);
+    bool send_params = (receiver_version.params_digest != version.params_digest);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_compute += time_span;
+    cout << "Changed ciphertexts: " << indices.size() << " of " << version.digests.size() << endl;
+
+    // Load changed ciphertexts
+    cout << "Loading changed ciphertexts..." << flush;
+    start = high_resolution_clock::now();
+    auto [cuckoo, encrypted_table] = loadTable(table.filename, sender_context_ptr, indices);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_io += time_span;
+
+    // Send changes to Receiver
+    cout << "Sending table changes to Receiver..." << flush;
+    start = high_resolution_clock::now();
+    sendTableDelta(socket, cuckoo, encrypted_table, version, indices, send_params);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_network += time_span;
+
+    // Show total time
+    cout << endl;
+    cout << "Total time (compute): " << time_compute << " " << time_unit << endl;
+    cout << "Total time (network): " << time_network << " " << time_unit << endl;
+    cout << "Total time (I/O): " << time_io << " " << time_unit << endl;
+}
+catch (const exception & e) { cerr << e.what() << endl; return 1; }
+catch (const char * e) { cerr << e << endl; return 1; }
+catch (const string & e) { cerr << e << endl; return 1; }
+catch (...) { cerr << "Unknown exception" << endl; return 1; }
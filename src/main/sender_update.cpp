@@ -0,0 +1,171 @@
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bfv.h"
+#include "crt.h"
+#include "crypto_io.h"
+#include "io.h"
+#include "kuckoo.h"
+#include "party.h"
+#include "psi.h"
+#include "seal/seal.h"
+#include "stash.h"
+
+using namespace cuckoo;
+using namespace fhe;
+using namespace io;
+using namespace math;
+using namespace psi;
+using namespace seal;
+using namespace std;
+using namespace std::chrono;
+
+using TimeUnit = milliseconds;
+const string time_unit = "ms";
+
+int main(int argc, char * argv[])
+try
+{
+    auto [success, compute, sender, receiver, set, table] = processInput(argc, argv);
+    if (!success) { usageMessage(argv); return 1; }
+
+    cout << "Sender's Set Update" << endl << endl;
+
+    cout << "Compute parameters:" << endl << compute << endl;
+    cout << "Sender parameters:" << endl << sender << endl;
+    cout << "Set parameters:" << endl << set << endl;
+    cout << "Table parameters:" << endl << table << endl;
+
+    time_point<high_resolution_clock> start, end;
+    uint64_t time_span;
+    uint64_t time_compute, time_io;
+    time_compute = time_io = 0;
+
+    // CRT parameters
+    cout << "Calculating CRT parameters..." << flush;
+    start = high_resolution_clock::now();
+    auto crt = crtParams(sender.ti);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_compute += time_span;
+
+    // Load Sender's keys
+    cout << "Loading Sender's keys..." << flush;
+    SEALContext* sender_context_ptr;
+    SecretKey* sender_secret_key_ptr;
+    do
+    {
+        start = high_resolution_clock::now();
+        sender_context_ptr = instantiateEncryptionScheme(sender.n, sender.logqi, sender.ti);
+        sender_secret_key_ptr = loadSecretKey(sender.filename_sk, sender_context_ptr);
+        end = high_resolution_clock::now();
+    } while (!validKeys(sender_context_ptr));
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_io += time_span;
+
+    // Load Cuckoo hash table (plaintext)
+    cout << "Loading Cuckoo hash table..." << flush;
+    start = high_resolution_clock::now();
+    auto cuckoo = loadCuckoo(table.filename);
+    auto version = loadVersion(table.filename);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_io += time_span;
+
+    // Loading set updates
+    cout << "Loading set updates..." << flush;
+    start = high_resolution_clock::now();
+    vector<Party> erasures, insertions;
+    for (auto & filename : set.erase_filenames) erasures.push_back(Party(filename));
+    for (auto & filename : set.insert_filenames) insertions.push_back(Party(filename));
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_io += time_span;
+
+    // Update Cuckoo hash table (erasures first, so their bins can be reused)
+    cout << "Updating Cuckoo hash table..." << flush;
+    start = high_resolution_clock::now();
+    uint64_t num_erased = 0, num_inserted = 0;
+    cuckoo.clearDirtyBins();
+    cuckoo.setInsertion(table.insertion);
+    for (auto & party : erasures)
+        for (auto value : party.getSet()) num_erased += cuckoo.erase(value);
+    for (auto & party : insertions)
+    {
+        for (auto value : party.getSet())
+        {
+            if (cuckoo.contains(value)) continue;
+            // a failed insertion rehashes the table of the value, whose bins then all change; if that fails too,
+            // nothing has been saved yet, so the table files are left as they were
+            try { cuckoo.insert(value, compute.num_threads, table.max_rehashes); }
+            catch (const runtime_error &)
+            {
+                throw "Could not insert element " + to_string(value) + " after " + to_string(table.max_rehashes)
+                    + " rehashes (see max_rehashes); the table files were left unchanged";
+            }
+            num_inserted++;
+        }
+    }
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_compute += time_span;
+    cout << "Erased " << num_erased << " and inserted " << num_inserted << " elements" << endl;
+    if (num_inserted) cout << "Evictions per insert: " << double(cuckoo.getEvictions()) / num_inserted << endl;
+    cout << "Rehashed tables: " << cuckoo.getRehashes() << endl;
+
+    // Re-encrypt the ciphertexts covering changed bins
+    cout << "Encrypting changed ciphertexts..." << flush;
+    start = high_resolution_clock::now();
+    auto sender_encoder_ptr = new BatchEncoder(*sender_context_ptr);
+    auto sender_encryptor_ptr = new Encryptor(*sender_context_ptr, *sender_secret_key_ptr);
+    uint64_t sender_n = sender_encoder_ptr->slot_count();
+    vector<uint64_t> indices;
+    for (auto bin : cuckoo.getDirtyBins())
+        if (indices.empty() || indices.back() != bin / sender_n) indices.push_back(bin / sender_n);
+    if (cuckoo.getDirtyStash()) // the stash ciphertexts follow the table ones
+    {
+        uint64_t table_cts = cuckoo.getTableSize() / sender_n + bool(cuckoo.getTableSize() % sender_n);
+        for (uint64_t i = 0; i < stashLayout(cuckoo, crt, sender_n).num_chunks; i++) indices.push_back(table_cts + i);
+    }
+    vector<Ciphertext> encrypted_table;
+    encryptTable(encrypted_table, cuckoo, crt, sender_encoder_ptr, sender_encryptor_ptr, indices, compute.num_threads);
+    auto sender_evaluator_ptr = new Evaluator(*sender_context_ptr);
+    switchTable(encrypted_table, cuckoo, crt, sender_encoder_ptr, sender_evaluator_ptr, levelOfPrimes(sender_context_ptr, version.level), indices, compute.num_threads);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_compute += time_span;
+    cout << "Changed ciphertexts: " << indices.size() << " of " << encrypted_table.size() << endl;
+
+    // Save Cuckoo hash table
+    cout << "Saving Cuckoo hash table..." << flush;
+    start = high_resolution_clock::now();
+    saveTable(table.filename, cuckoo, encrypted_table, indices);
+    cuckoo.clearDirtyBins();
+    saveCuckoo(table.filename, cuckoo);
+    if (!indices.empty()) version.version++;
+    version.params_digest = digest(cuckoo);
+    for (auto i : indices) version.digests[i] = digest(encrypted_table[i]);
+    saveVersion(table.filename, version);
+    end = high_resolution_clock::now();
+    time_span = duration_cast<TimeUnit>(end - start).count();
+    cout << "done (" << time_span << " " << time_unit << ")" << endl;
+    time_io += time_span;
+
+    // Show total time
+    cout << endl;
+    cout << "Total time (compute): " << time_compute << " " << time_unit << endl;
+    cout << "Total time (I/O): " << time_io << " " << time_unit << endl;
+    cout << "Table version: " << version.version << endl;
+}
+catch (const exception & e) { cerr << e.what() << endl; return 1; }
+catch (const char * e) { cerr << e << endl; return 1; }
+catch (const string & e) { cerr << e << endl; return 1; }
+catch (...) { cerr << "Unknown exception" << endl; return 1; }
@@ -1,5 +1,6 @@
 #include "crt.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <vector>
 #include "math.h"
@@ -9,15 +10,112 @@ using namespace std;
 namespace math
 {
 
+using u128 = unsigned __int128;
+
+// x mod m for any 64-bit x: the quotient estimate is at most one short
+static inline uint64_t barrettReduce(uint64_t x, uint64_t m, uint64_t m_barrett)
+{
+    uint64_t q = uint64_t((u128(x) * m_barrett) >> 64);
+    uint64_t r = x - q * m;
+    return r >= m ? r - m : r;
+}
+
+// x * w mod M for any 64-bit x, in [0, 2M), with w_shoup = floor(w * 2^64 / M) and M < 2^63
+static inline uint64_t shoupMultiply(uint64_t x, uint64_t w, uint64_t w_shoup, uint64_t M)
+{
+    uint64_t q = uint64_t((u128(x) * w_shoup) >> 64);
+    return x * w - q * M;
+}
+
+// K > 0 fixes the number of CRT components at compile time so the inner loops unroll
+// K = 0 handles any number of components
+template <uint64_t K>
+static void crtDecode(const uint64_t * vpack, uint64_t size, const CrtParams & crt, uint64_t * vs)
+{
+    const uint64_t step = K ? K : crt.mi.size();
+    const uint64_t * mi = crt.mi.data();
+    const uint64_t * mi_barrett = crt.mi_barrett.data();
+    for (uint64_t i=0; i<size; i++)
+        for (uint64_t j=0; j<step; j++) vs[i*step+j] = barrettReduce(vpack[i], mi[j], mi_barrett[j]);
+}
+
+template <uint64_t K>
+static void crtEncode(const vector<uint64_t> & vs, const CrtParams & crt, vector<uint64_t> & vpack)
+{
+    const uint64_t step = K ? K : crt.mi.size();
+    const uint64_t M = crt.M;
+    const uint64_t * MiiMi = crt.MiiMi.data();
+    const uint64_t * MiiMi_shoup = crt.MiiMi_shoup.data();
+    for (size_t i=0; i<vpack.size(); i++)
+    {
+        uint64_t sum = 0;
+        for (size_t j=0; j<step; j++)
+        {
+            uint64_t term = shoupMultiply(vs[i*step + j], MiiMi[j], MiiMi_shoup[j], M);
+            if (term >= M) term -= M;
+            sum += term;
+            if (sum >= M) sum -= M;
+        }
+        vpack[i] = sum;
+    }
+}
+
+void crtDecode(const uint64_t * vpack, uint64_t size, const CrtParams & crt, uint64_t * vs)
+{
+    switch (crt.mi.size())
+    {
+        case 1: crtDecode<1>(vpack, size, crt, vs); break;
+        case 2: crtDecode<2>(vpack, size, crt, vs); break;
+        default: crtDecode<0>(vpack, size, crt, vs);
+    }
+}
+
 vector<uint64_t> crtDecode(const vector<uint64_t> & vpack, const CrtParams & crt)
 {
-    auto step = crt.mi.size();
-    vector<uint64_t> vs(vpack.size() * step);
-    for (uint64_t i=0; i<vpack.size(); i++)
-        for (uint64_t j=0; j<step; j++) vs[i*step+j] = vpack[i] % crt.mi[j];
+    vector<uint64_t> vs(vpack.size() * crt.mi.size());
+    crtDecode(vpack.data(), vpack.size(), crt, vs.data());
     return vs;
 }
 
+// number of the 'count' packed values that are multiples of an odd mi, by the test of CrtParams::isZero;
+// the loop is branch-free so it vectorizes, and target_clones builds it for AVX-512 and AVX2 as well as the
+// baseline, picking the one the CPU supports at load time, so the build needs no -march
+__attribute__((target_clones("arch=skylake-avx512", "avx2", "default")))
+static uint64_t countMultiples(const uint64_t * vpack, uint64_t count, uint64_t mi_inverse, uint64_t mi_barrett)
+{
+    uint64_t zeros = 0;
+    for (uint64_t i=0; i<count; i++) zeros += divisible(vpack[i], mi_inverse, mi_barrett);
+    return zeros;
+}
+
+template <uint64_t K>
+static uint64_t crtCountZeros(const uint64_t * vpack, uint64_t size, const CrtParams & crt, uint64_t limit)
+{
+    const uint64_t step = K ? K : crt.mi.size();
+    const uint64_t block = 1024; // slots between checks of the limit
+    uint64_t zeros = 0;
+    for (uint64_t first=0; first<size && zeros<limit; first+=block)
+    {
+        const uint64_t count = min(size - first, block);
+        for (uint64_t j=0; j<step; j++)
+        {
+            if (crt.mi_inverse[j]) zeros += countMultiples(vpack + first, count, crt.mi_inverse[j], crt.mi_barrett[j]);
+            else for (uint64_t i=first; i<first+count; i++) zeros += vpack[i] % crt.mi[j] == 0;
+        }
+    }
+    return min(zeros, limit);
+}
+
+uint64_t crtCountZeros(const uint64_t * vpack, uint64_t size, const CrtParams & crt, uint64_t limit)
+{
+    switch (crt.mi.size())
+    {
+        case 1: return crtCountZeros<1>(vpack, size, crt, limit);
+        case 2: return crtCountZeros<2>(vpack, size, crt, limit);
+        default: return crtCountZeros<0>(vpack, size, crt, limit);
+    }
+}
+
 vector<uint64_t> crtEncode(const vector<uint64_t> & vs, const CrtParams & crt)
 {
     auto step = crt.mi.size();
@@ -26,16 +124,11 @@ vector<uint64_t> crtEncode(const vector<uint64_t> & vs, const CrtParams & crt)
 
     auto size = vs.size() / step;
     vector<uint64_t> vpack(size, 0);
-    for (size_t i=0; i<size; i++)
+    switch (step)
     {
-        for (size_t j=0; j<step; j++)
-        {
-            auto v = vs[i*step + j];
-            uint64_t Mi = crt.Mi[j];
-            uint64_t iMi = crt.iMi[j];
-            vpack[i] += v*Mi*iMi;
-        }
-        vpack[i] %= crt.M;
+        case 1: crtEncode<1>(vs, crt, vpack); break;
+        case 2: crtEncode<2>(vs, crt, vpack); break;
+        default: crtEncode<0>(vs, crt, vpack);
     }
     return vpack;
 }
@@ -45,10 +138,22 @@ CrtParams crtParams(const vector<uint64_t> & vt)
     CrtParams crt;
     crt.mi = vt;
     crt.M = 1;
-    for (const auto mi : crt.mi) crt.M *= mi;
+    for (const auto mi : crt.mi)
+    {
+        // checked before each product, which would otherwise wrap around 2^64 unnoticed
+        if ((u128(crt.M) * mi) >> 63) throw "CRT modulus must be below 2^63";
+        crt.M *= mi;
+    }
     for (const auto mi : crt.mi) crt.Mi.push_back(crt.M/mi);
-    for (uint64_t i=0; i<crt.Mi.size(); i++) crt.iMi.push_back(modinv(crt.Mi[i],crt.mi[i]));
+    for (uint64_t i=0; i<crt.Mi.size(); i++)
+    {
+        crt.iMi.push_back(modinv(crt.Mi[i],crt.mi[i]));
+        crt.MiiMi.push_back(uint64_t(u128(crt.Mi[i]) * crt.iMi[i] % crt.M));
+        crt.MiiMi_shoup.push_back(uint64_t((u128(crt.MiiMi[i]) << 64) / crt.M));
+        crt.mi_barrett.push_back(~0ULL / crt.mi[i]);
+        crt.mi_inverse.push_back(oddInverse(crt.mi[i]));
+    }
     return crt;
 }
 
-} // math
\ No newline at end of file
+} // math
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <vector>
+#include "math.h"
 
 namespace math
 {
@@ -12,12 +13,23 @@ struct CrtParams
     std::vector<uint64_t> mi;
     std::vector<uint64_t> Mi;
     std::vector<uint64_t> iMi;
+    std::vector<uint64_t> MiiMi; // Mi * iMi mod M, the packed value of a 1 in component i
+    std::vector<uint64_t> MiiMi_shoup; // floor(MiiMi * 2^64 / M), multiplies by MiiMi modulo M without division
+    std::vector<uint64_t> mi_barrett; // floor((2^64 - 1) / mi), reduces modulo mi without division
+    std::vector<uint64_t> mi_inverse; // oddInverse(mi): mi^-1 mod 2^64 if mi is odd, 0 otherwise
+
+    // whether component j of packed value x is 0, without division for an odd mi
+    bool isZero(uint64_t x, uint64_t j) const { return mi_inverse[j] ? divisible(x, mi_inverse[j], mi_barrett[j]) : x % mi[j] == 0; }
 };
 
 std::vector<uint64_t> crtDecode(const std::vector<uint64_t> & vpack, const CrtParams & crt);
+void crtDecode(const uint64_t * vpack, uint64_t size, const CrtParams & crt, uint64_t * vs); // into k * size values
+
+// number of CRT components equal to 0 in the packed values, without decoding them; stops counting at 'limit'
+uint64_t crtCountZeros(const uint64_t * vpack, uint64_t size, const CrtParams & crt, uint64_t limit);
 
 std::vector<uint64_t> crtEncode(const std::vector<uint64_t> & vs, const CrtParams & crt);
 
 CrtParams crtParams(const std::vector<uint64_t> & vt);
 
-} // math
\ No newline at end of file
+} // math
@@ -25,12 +25,27 @@ uint64_t flog2(uint64_t x)
     return result;
 }
 
+// inverse of a modulo m by the extended Euclidean algorithm, 1 if there is none
 uint64_t modinv(uint64_t a, uint64_t m)
 {
-    a = a % m;
-    for (uint64_t x=1; x<m; x++)
-        if ((a*x) % m == 1) return x;
-    return 1;
+    int64_t r0 = m, r1 = a % m, x0 = 0, x1 = 1;
+    while (r1)
+    {
+        int64_t q = r0 / r1;
+        int64_t r = r0 - q * r1; r0 = r1; r1 = r;
+        int64_t x = x0 - q * x1; x0 = x1; x1 = x;
+    }
+    if (r0 != 1) return 1;
+    return x0 < 0 ? uint64_t(x0 + int64_t(m)) : uint64_t(x0);
+}
+
+// m^-1 mod 2^64 for an odd m, 0 for an even one
+uint64_t oddInverse(uint64_t m)
+{
+    if (!(m & 1)) return 0;
+    uint64_t inverse = m; // Newton's iteration doubles the correct low bits: 3, 6, 12, 24, 48, 96
+    for (int i = 0; i < 5; i++) inverse *= 2 - m * inverse;
+    return inverse;
 }
 
 // modular exponentiation
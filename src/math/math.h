@@ -7,13 +7,19 @@ namespace math
 {
 
 uint64_t clog2(uint64_t x);
+inline bool divisible(uint64_t x, uint64_t inverse, uint64_t limit);
 uint64_t flog2(uint64_t x);
 uint64_t modinv(uint64_t a, uint64_t m);
+uint64_t oddInverse(uint64_t m);
 uint64_t powm(uint64_t b, uint64_t e, uint64_t m);
 uint64_t shiftLeft(uint64_t x, uint64_t s);
 uint64_t shiftRight(uint64_t x, uint64_t s);
 template <class T> T sum(const std::vector<T> & v);
 
+// whether x is a multiple of an odd m, given inverse = oddInverse(m) and limit = (2^64 - 1) / m:
+// the multiples of m are exactly the x with x * m^-1 mod 2^64 <= limit, which needs no division
+inline bool divisible(uint64_t x, uint64_t inverse, uint64_t limit) { return x * inverse <= limit; }
+
 template <class T>
 T sum(const std::vector<T> & v)
 {
@@ -3,40 +3,153 @@
 #include <cstdint>
 #include <random>
 #include <vector>
+#include "math.h"
 
 using namespace std;
 
 namespace math
 {
 
-vector<uint64_t> randomVector(uint64_t num_entries, uint64_t min_value, uint64_t max_value)
+using u128 = unsigned __int128;
+
+// one quarter round on each of the 'Csprng::blocks' interleaved blocks, which the compiler vectorizes
+template <uint64_t B>
+static inline void quarterRound(uint32_t (&x)[16][B], int a, int b, int c, int d)
+{
+    for (uint64_t l = 0; l < B; l++)
+    {
+        x[a][l] += x[b][l]; x[d][l] ^= x[a][l]; x[d][l] = (x[d][l] << 16) | (x[d][l] >> 16);
+        x[c][l] += x[d][l]; x[b][l] ^= x[c][l]; x[b][l] = (x[b][l] << 12) | (x[b][l] >> 20);
+        x[a][l] += x[b][l]; x[d][l] ^= x[a][l]; x[d][l] = (x[d][l] << 8) | (x[d][l] >> 24);
+        x[c][l] += x[d][l]; x[b][l] ^= x[c][l]; x[b][l] = (x[b][l] << 7) | (x[b][l] >> 25);
+    }
+}
+
+Csprng::Csprng()
 {
     random_device rd;
-    mt19937 gen(rd());
-    uniform_int_distribution<uint64_t> dist(min_value, max_value);
+    state = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574}; // "expand 32-byte k"
+    for (int i = 4; i < 12; i++) state[i] = rd(); // 256-bit key
+    state[12] = state[13] = 0; // block counter
+    state[14] = rd(); // nonce
+    state[15] = rd();
+    used = buffer.size();
+}
 
-    vector<uint64_t> result(num_entries);
-    for (uint64_t i = 0; i < num_entries; i++)
-        result[i] = dist(gen);
+void Csprng::refill()
+{
+    // lane l holds block counter + l
+    uint32_t x[16][blocks], counter[2][blocks];
+    for (uint64_t l = 0; l < blocks; l++)
+    {
+        uint64_t c = (uint64_t(state[13]) << 32 | state[12]) + l;
+        counter[0][l] = uint32_t(c);
+        counter[1][l] = uint32_t(c >> 32);
+    }
+    for (int i = 0; i < 16; i++)
+        for (uint64_t l = 0; l < blocks; l++) x[i][l] = i == 12 || i == 13 ? counter[i-12][l] : state[i];
+
+    for (int round = 0; round < 10; round++)
+    {
+        quarterRound(x, 0, 4, 8, 12);
+        quarterRound(x, 1, 5, 9, 13);
+        quarterRound(x, 2, 6, 10, 14);
+        quarterRound(x, 3, 7, 11, 15);
+        quarterRound(x, 0, 5, 10, 15);
+        quarterRound(x, 1, 6, 11, 12);
+        quarterRound(x, 2, 7, 8, 13);
+        quarterRound(x, 3, 4, 9, 14);
+    }
+
+    for (uint64_t l = 0; l < blocks; l++)
+    {
+        for (int i = 0; i < 16; i++) x[i][l] += i == 12 || i == 13 ? counter[i-12][l] : state[i];
+        for (int i = 0; i < 8; i++) buffer[8*l + i] = uint64_t(x[2*i][l]) | (uint64_t(x[2*i+1][l]) << 32);
+    }
+
+    uint64_t c = (uint64_t(state[13]) << 32 | state[12]) + blocks;
+    state[12] = uint32_t(c);
+    state[13] = uint32_t(c >> 32);
+    used = 0;
+}
+
+Csprng::result_type Csprng::operator()()
+{
+    if (used == buffer.size()) refill();
+    return buffer[used++];
+}
+
+uint64_t Csprng::uniform(uint64_t min_value, uint64_t max_value)
+{
+    uint64_t value;
+    fill(&value, 1, min_value, max_value);
+    return value;
+}
 
+// Lemire's multiply-shift: the high word of x * range, resampling the few x whose low word falls below 2^64 mod range
+void Csprng::fill(uint64_t * out, uint64_t count, uint64_t min_value, uint64_t max_value)
+{
+    const uint64_t range = max_value - min_value + 1; // 0 for the full 64-bit range
+    if (!range)
+    {
+        for (uint64_t i = 0; i < count; i++) out[i] = (*this)();
+        return;
+    }
+    const uint64_t threshold = -range % range;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        u128 m = u128((*this)()) * range;
+        while (uint64_t(m) < threshold) m = u128((*this)()) * range;
+        out[i] = min_value + uint64_t(m >> 64);
+    }
+}
+
+Csprng & generator()
+{
+    thread_local Csprng gen;
+    return gen;
+}
+
+vector<uint64_t> randomVector(uint64_t num_entries, uint64_t min_value, uint64_t max_value)
+{
+    vector<uint64_t> result(num_entries);
+    generator().fill(result.data(), num_entries, min_value, max_value);
     return result;
 }
 
+// an odd modulus is tested with 'divisible', without division
+struct Divisor
+{
+    uint64_t modulus;
+    uint64_t inverse; // 0 for an even modulus, tested with %
+    uint64_t limit;
+};
+
 vector<uint64_t> randomVector(uint64_t num_entries, uint64_t min_value, uint64_t max_value, const vector<uint64_t> & moduli)
 {
-    random_device rd;
-    mt19937 gen(rd());
-    uniform_int_distribution<uint64_t> dist(min_value, max_value);
+    vector<Divisor> divisors;
+    for (auto modulus : moduli) divisors.push_back({modulus, oddInverse(modulus), ~0ULL / modulus});
 
+    // draw the missing entries in bulk and keep, in place, those divisible by no modulus
     vector<uint64_t> result(num_entries);
-    for (uint64_t i = 0; i < num_entries; i++)
+    auto & gen = generator();
+    for (uint64_t filled = 0; filled < num_entries;)
     {
-        result[i] = dist(gen);
-        for (const auto & modulus : moduli)
-            if (result[i] % modulus == 0) { i--; break; }
+        gen.fill(result.data() + filled, num_entries - filled, min_value, max_value);
+        uint64_t kept = filled;
+        for (uint64_t i = filled; i < num_entries; i++)
+        {
+            uint64_t value = result[i];
+            bool multiple = false;
+            for (const auto & d : divisors)
+                multiple |= d.inverse ? divisible(value, d.inverse, d.limit) : value % d.modulus == 0;
+            result[kept] = value;
+            kept += !multiple;
+        }
+        filled = kept;
     }
 
     return result;
 }
 
-} // math
\ No newline at end of file
+} // math
@@ -1,12 +1,46 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <limits>
 #include <vector>
 
 namespace math
 {
 
+// ChaCha20 in counter mode, keyed from std::random_device; a UniformRandomBitGenerator, so it also
+// drives the std distributions. Not thread-safe, use one generator per thread (see 'generator')
+class Csprng
+{
+    public:
+        using result_type = uint64_t;
+
+    private:
+        static const uint64_t blocks = 4; // ChaCha20 blocks generated per refill
+        std::array<uint32_t, 16> state; // constants, key, 64-bit block counter and nonce
+        std::array<uint64_t, 8 * blocks> buffer;
+        uint64_t used;
+
+        void refill();
+
+    public:
+        Csprng();
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+        result_type operator()();
+
+        // uniform in [min_value, max_value], without modulo bias
+        uint64_t uniform(uint64_t min_value, uint64_t max_value);
+
+        // fills 'out' with uniform values in [min_value, max_value]
+        void fill(uint64_t * out, uint64_t count, uint64_t min_value, uint64_t max_value);
+};
+
+// the calling thread's generator
+Csprng & generator();
+
 std::vector<uint64_t> randomVector(uint64_t num_entries, uint64_t min_value, uint64_t max_value);
-std::vector<uint64_t> randomVector(uint64_t num_entries, uint64_t min_value, uint64_t max_value, const std::vector<uint64_t> & moduli);
+std::vector<uint64_t> randomVector(uint64_t num_entries, uint64_t min_value, uint64_t max_value, const std::vector<uint64_t> & moduli); // no entry divisible by a modulus
 
-} // math
\ No newline at end of file
+} // math
@@ -3,11 +3,13 @@
 #include <sstream>
 #include <tuple>
 #include <vector>
+#include "crypto_io.h"
 #include "kuckoo.h"
 #include "seal/seal.h"
 #include "socket.h"
 
 using namespace cuckoo;
+using namespace io;
 using namespace seal;
 using namespace std;
 
@@ -73,6 +75,55 @@ tuple<Kuckoo, vector<Ciphertext>> receiveTable(Socket & socket, const SEALContex
     return { cuckoo, table };
 }
 
+vector<uint64_t> receiveTableDelta(Socket & socket, const SEALContext * context_ptr, Kuckoo & cuckoo, vector<Ciphertext> & table, TableVersion & version)
+{
+    // Receive the new table version
+    version = receiveVersion(socket);
+    table.resize(version.digests.size());
+
+    // Receive the indices of the changed ciphertexts
+    bool params_changed;
+    size_t size;
+    vector<uint64_t> indices;
+    {
+        stringstream ss = socket.receive();
+        ss >> params_changed >> size;
+        indices.resize(size);
+        for (auto & i : indices) ss >> i;
+    }
+
+    // Receive the new table parameters
+    if (params_changed)
+    {
+        Kuckoo params;
+        socket.receive() >> params;
+        cuckoo = params;
+    }
+    if (digest(cuckoo) != version.params_digest) throw "Table synchronization failed (parameters)";
+
+    // Receive each changed ciphertext
+    for (auto i : indices)
+    {
+        stringstream ss = socket.receive();
+        if (digest(ss.str()) != version.digests[i]) throw "Table synchronization failed (ciphertext " + to_string(i) + ")";
+        table[i].load(*context_ptr, ss);
+    }
+
+    return indices;
+}
+
+TableVersion receiveVersion(Socket & socket)
+{
+    TableVersion version;
+    size_t size;
+    stringstream ss = socket.receive();
+    ss >> version.version >> version.params_digest >> size;
+    version.digests.resize(size);
+    for (auto & d : version.digests) ss >> d;
+    ss >> version.level;
+    return version;
+}
+
 void sendCiphertexts(Socket & socket, const vector<vector<Ciphertext>> & cts)
 {
     if (cts.empty()) throw "Cannot send an empty vector of ciphertexts.";
@@ -136,4 +187,43 @@ void sendTable(Socket & socket, const Kuckoo & cuckoo, const vector<Ciphertext>
     }
 }
 
+void sendTableDelta(Socket & socket, const Kuckoo & cuckoo, const vector<Ciphertext> & table, const TableVersion & version, const vector<uint64_t> & indices, bool send_params)
+{
+    // Send the new table version
+    sendVersion(socket, version);
+
+    // Send the indices of the changed ciphertexts
+    {
+        stringstream ss;
+        ss << send_params << " " << indices.size();
+        for (auto i : indices) ss << " " << i;
+        socket.send(ss);
+    }
+
+    // Send the table parameters
+    if (send_params)
+    {
+        stringstream ss;
+        ss << cuckoo;
+        socket.send(ss);
+    }
+
+    // Send each changed ciphertext
+    for (auto i : indices)
+    {
+        stringstream ss;
+        table[i].save(ss);
+        socket.send(ss);
+    }
+}
+
+void sendVersion(Socket & socket, const TableVersion & version)
+{
+    stringstream ss;
+    ss << version.version << " " << version.params_digest << " " << version.digests.size();
+    for (auto d : version.digests) ss << " " << d;
+    ss << " " << version.level;
+    socket.send(ss);
+}
+
 } // network
\ No newline at end of file
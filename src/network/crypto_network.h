@@ -2,6 +2,7 @@
 
 #include <tuple>
 #include <vector>
+#include "crypto_io.h"
 #include "kuckoo.h"
 #include "seal/seal.h"
 #include "socket.h"
@@ -17,6 +18,10 @@ seal::RelinKeys * receiveRelinKeys(network::Socket & socket, const seal::SEALCon
 
 std::tuple<cuckoo::Kuckoo, std::vector<seal::Ciphertext>> receiveTable(network::Socket & socket, const seal::SEALContext * context_ptr);
 
+std::vector<uint64_t> receiveTableDelta(network::Socket & socket, const seal::SEALContext * context_ptr, cuckoo::Kuckoo & cuckoo, std::vector<seal::Ciphertext> & table, io::TableVersion & version);
+
+io::TableVersion receiveVersion(network::Socket & socket);
+
 void sendCiphertexts(network::Socket & socket, const std::vector<std::vector<seal::Ciphertext>> & cts);
 
 void sendGaloisKeys(network::Socket & socket, const seal::GaloisKeys * galoiskeys_ptr);
@@ -25,4 +30,8 @@ void sendRelinKeys(network::Socket & socket, const seal::RelinKeys * relinkeys_p
 
 void sendTable(network::Socket & socket, const cuckoo::Kuckoo & cuckoo, const std::vector<seal::Ciphertext> & table);
 
+void sendTableDelta(network::Socket & socket, const cuckoo::Kuckoo & cuckoo, const std::vector<seal::Ciphertext> & table, const io::TableVersion & version, const std::vector<uint64_t> & indices, bool send_params);
+
+void sendVersion(network::Socket & socket, const io::TableVersion & version);
+
 } // network
\ No newline at end of file
@@ -119,7 +119,7 @@ stringstream Socket::receive()
 {
     // Receive data stream size
     int valread, data_size;
-    if ((valread = read(this->remote_fd, &data_size, sizeof(data_size))) < 0)
+    if ((valread = read(this->remote_fd, &data_size, sizeof(data_size))) <= 0) // 0 once the peer is gone
         throw "Socket failed to receive the data stream size";
     
     // Receive data stream
@@ -127,7 +127,7 @@ stringstream Socket::receive()
     while (data_size > 0)
     {
         int size = min(data_size, this->rcvbuf_size);
-        if ((valread = read(this->remote_fd, this->rcvbuf, size)) < 0)
+        if ((valread = read(this->remote_fd, this->rcvbuf, size)) <= 0)
             throw "Socket failed to receive the data stream";
         ss.write(this->rcvbuf, valread);
         data_size -= valread;
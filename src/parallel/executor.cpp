@@ -0,0 +1,174 @@
+#include "executor.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+namespace parallel
+{
+
+// the executor the calling thread works for, if any, and its queue there
+static thread_local const Executor * current = nullptr;
+static thread_local uint64_t current_id = 0;
+
+uint64_t TaskGraph::add(function<void()> task)
+{
+    nodes.emplace_back(move(task));
+    return nodes.size() - 1;
+}
+
+void TaskGraph::precede(uint64_t before, uint64_t after)
+{
+    nodes[before].successors.push_back(after);
+    nodes[after].dependencies++;
+}
+
+Executor::Executor(uint64_t num_workers) { resize(num_workers); }
+
+Executor::~Executor() { resize(0); }
+
+void Executor::resize(uint64_t num_workers)
+{
+    {
+        lock_guard<mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto & worker : workers) worker.join();
+    workers.clear();
+    stopping = false;
+
+    queues.clear();
+    for (uint64_t i=0; i<=num_workers; i++) queues.push_back(make_unique<Queue>());
+    for (uint64_t i=0; i<num_workers; i++) workers.emplace_back([this, i]() { work(i); });
+}
+
+uint64_t Executor::self() const
+{
+    return current == this ? current_id : workers.size();
+}
+
+void Executor::push(Task task)
+{
+    auto & queue = *queues[self()];
+    {
+        lock_guard<mutex> lock(queue.mutex);
+        queue.tasks.push_back(move(task));
+    }
+    {
+        lock_guard<mutex> lock(sleep_mutex);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+bool Executor::runOne()
+{
+    const uint64_t id = self();
+    Task task;
+    for (uint64_t l=0; l<queues.size() && !task; l++)
+    {
+        // own queue newest first, which keeps nested tasks local, then the oldest task of the next ones
+        auto & queue = *queues[(id + l) % queues.size()];
+        lock_guard<mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        if (l == 0) { task = move(queue.tasks.back()); queue.tasks.pop_back(); }
+        else { task = move(queue.tasks.front()); queue.tasks.pop_front(); }
+    }
+    if (!task) return false;
+    queued--;
+    task();
+    return true;
+}
+
+void Executor::execute(Group & group, const function<void()> & f)
+{
+    if (!group.failed)
+    try { f(); }
+    catch (...)
+    {
+        lock_guard<mutex> lock(group.error_mutex);
+        if (!group.error) group.error = current_exception();
+        group.failed = true;
+    }
+}
+
+void Executor::finish(Group & group)
+{
+    if (group.remaining.fetch_sub(1) == 1)
+    {
+        lock_guard<mutex> lock(sleep_mutex); // the waiting thread may be about to sleep
+        wake.notify_all();
+    }
+}
+
+void Executor::run(Group & group, const function<void()> & f)
+{
+    execute(group, f);
+    finish(group);
+}
+
+void Executor::runNode(TaskGraph & graph, uint64_t id, Group & group)
+{
+    auto & node = graph.nodes[id];
+    execute(group, node.task);
+    for (auto successor : node.successors)
+        if (graph.nodes[successor].remaining.fetch_sub(1) == 1)
+            push([this, &graph, successor, &group]() { runNode(graph, successor, group); });
+    finish(group); // last, as the graph may be gone after it
+}
+
+void Executor::run(TaskGraph & graph)
+{
+    if (!graph.size()) return;
+    Group group(graph.size());
+    for (auto & node : graph.nodes) node.remaining = node.dependencies;
+    for (uint64_t id=0; id<graph.size(); id++)
+        if (!graph.nodes[id].dependencies) push([this, &graph, id, &group]() { runNode(graph, id, group); });
+    wait(group);
+    if (group.error) rethrow_exception(group.error);
+}
+
+void Executor::wait(Group & group)
+{
+    while (group.remaining)
+    {
+        if (runOne()) continue;
+        unique_lock<mutex> lock(sleep_mutex);
+        wake.wait(lock, [this, &group]() { return queued || !group.remaining; });
+    }
+}
+
+void Executor::work(uint64_t id)
+{
+    current = this;
+    current_id = id;
+    while (true)
+    {
+        if (runOne()) continue;
+        unique_lock<mutex> lock(sleep_mutex);
+        wake.wait(lock, [this]() { return queued || stopping; });
+        if (stopping && !queued) return;
+    }
+}
+
+Executor & executor(uint64_t num_threads)
+{
+    static mutex instances_mutex;
+    static map<uint64_t, unique_ptr<Executor>> instances;
+    num_threads = max<uint64_t>(num_threads, 1);
+    lock_guard<mutex> lock(instances_mutex);
+    auto & instance = instances[num_threads];
+    if (!instance) instance = make_unique<Executor>(num_threads - 1);
+    return *instance;
+}
+
+} // parallel
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace parallel
+{
+
+// Tasks and the order between them; Executor::run starts a task as soon as every task it waits for is done
+class TaskGraph
+{
+    friend class Executor;
+
+    private:
+        struct Node
+        {
+            std::function<void()> task;
+            std::vector<uint64_t> successors;
+            uint64_t dependencies = 0;
+            std::atomic<uint64_t> remaining{0}; // dependencies not done yet in the current run
+
+            Node(std::function<void()> task) : task(std::move(task)) {}
+        };
+
+        std::deque<Node> nodes; // a deque keeps the nodes in place as the graph grows
+
+    public:
+        // the id of the new task
+        uint64_t add(std::function<void()> task);
+
+        // 'after' starts once 'before' is done
+        void precede(uint64_t before, uint64_t after);
+
+        uint64_t size() const { return nodes.size(); }
+};
+
+// Persistent work-stealing thread pool. Each worker pops its own queue from the back and steals from
+// the front of the others; threads outside the pool share one extra queue. A thread waiting for its tasks
+// runs queued tasks meanwhile, so tasks may themselves call parallelFor without blocking a worker
+class Executor
+{
+    private:
+        using Task = std::function<void()>;
+
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        // the tasks of one parallelFor, and the first exception one of them threw
+        struct Group
+        {
+            std::atomic<uint64_t> remaining;
+            std::atomic<bool> failed{false}; // tasks that have not started yet are skipped
+            std::mutex error_mutex;
+            std::exception_ptr error;
+
+            Group(uint64_t size) : remaining(size) {}
+        };
+
+        std::vector<std::unique_ptr<Queue>> queues; // one per worker, then the one of outside threads
+        std::vector<std::thread> workers;
+        std::atomic<uint64_t> queued{0}; // tasks in all queues
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+
+        uint64_t self() const; // queue of the calling thread
+        void push(Task task);
+        bool runOne(); // false if every queue was empty
+        void execute(Group & group, const std::function<void()> & f); // unless a task of the group failed
+        void finish(Group & group); // and wake the thread waiting for the group
+        void run(Group & group, const std::function<void()> & f);
+        void runNode(TaskGraph & graph, uint64_t id, Group & group); // and push the successors it makes ready
+        void wait(Group & group);
+        void work(uint64_t id);
+        void resize(uint64_t num_workers); // joins the workers and starts 'num_workers' new ones
+
+    public:
+        Executor(uint64_t num_workers);
+        Executor(const Executor &) = delete;
+        Executor & operator=(const Executor &) = delete;
+        ~Executor();
+
+        uint64_t size() const { return workers.size(); }
+
+        // calls body(i) for every i in [0, size) as separate tasks, and returns when all are done;
+        // rethrows the first exception of a task
+        template <class Body>
+        void parallelFor(uint64_t size, Body body)
+        {
+            if (!size) return;
+            Group group(size);
+            for (uint64_t i=1; i<size; i++) push([this, &group, &body, i]() { run(group, [&body, i]() { body(i); }); });
+            run(group, [&body]() { body(0); });
+            wait(group);
+            if (group.error) std::rethrow_exception(group.error);
+        }
+
+        // runs every task of the graph after the ones it waits for, and returns when all are done;
+        // rethrows the first exception of a task
+        void run(TaskGraph & graph);
+};
+
+// the process-wide executor of 'num_threads' threads: 'num_threads' - 1 workers and the waiting caller. Each thread count
+// has its own, created on its first call, so every call runs on the threads it asks for whatever the earlier calls asked
+Executor & executor(uint64_t num_threads);
+
+} // parallel
@@ -0,0 +1,104 @@
+#include "masks.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "crt.h"
+#include "random.h"
+#include "seal/seal.h"
+
+using namespace math;
+using namespace seal;
+using namespace std;
+
+namespace psi
+{
+
+void makeMask
+(
+    Mask & mask,
+    const CrtParams & crt,
+    const BatchEncoder * sender_encoder_ptr,
+    const BatchEncoder * receiver_encoder_ptr,
+    const Encryptor * receiver_encryptor_ptr
+)
+{
+    auto random_values = randomVector(receiver_encoder_ptr->slot_count(), 0, crt.M - 1);
+    sender_encoder_ptr->encode(random_values, mask.sender_pt);
+    Plaintext receiver_pt;
+    receiver_encoder_ptr->encode(random_values, receiver_pt);
+    receiver_encryptor_ptr->encrypt_symmetric(receiver_pt, mask.receiver_ct);
+}
+
+Pool<Mask>::Maker maskMaker
+(
+    const CrtParams & crt,
+    const BatchEncoder * sender_encoder_ptr,
+    const BatchEncoder * receiver_encoder_ptr,
+    const Encryptor * receiver_encryptor_ptr
+)
+{
+    return [&crt, sender_encoder_ptr, receiver_encoder_ptr, receiver_encryptor_ptr](Mask & mask)
+    { makeMask(mask, crt, sender_encoder_ptr, receiver_encoder_ptr, receiver_encryptor_ptr); };
+}
+
+void makeRecryptMask(RecryptMask & mask, const CrtParams & crt, const BatchEncoder * receiver_encoder_ptr)
+{
+    const uint64_t receiver_n = receiver_encoder_ptr->slot_count();
+    auto random_values = randomVector(receiver_n, 1, crt.M, crt.mi);
+    receiver_encoder_ptr->encode(random_values, mask.receiver_pt);
+    mask.steps = generator().uniform(0, receiver_n-1);
+}
+
+Pool<RecryptMask>::Maker recryptMaskMaker(const CrtParams & crt, const BatchEncoder * receiver_encoder_ptr)
+{
+    return [&crt, receiver_encoder_ptr](RecryptMask & mask) { makeRecryptMask(mask, crt, receiver_encoder_ptr); };
+}
+
+void MaskPool::load(const string & filename, const CrtParams & crt, const SEALContext * sender_context_ptr, const SEALContext * receiver_context_ptr)
+{
+    lock_guard<mutex> lock(entries_mutex);
+    entries.clear();
+    {
+        ifstream file(filename, ios::binary);
+        uint64_t t = 0, size = 0;
+        file.read(reinterpret_cast<char *>(&t), sizeof(t));
+        file.read(reinterpret_cast<char *>(&size), sizeof(size));
+        if (file && t == crt.M)
+        try
+        {
+            for (uint64_t i = 0; i < min(size, depth); i++)
+            {
+                Mask mask;
+                mask.sender_pt.load(*sender_context_ptr, file);
+                mask.receiver_ct.load(*receiver_context_ptr, file);
+                entries.push_back(move(mask));
+            }
+        }
+        catch (const exception & e) { entries.clear(); }
+    }
+    remove(filename.c_str()); // the masks now live only in memory until 'save'
+    low_watermark = entries.size();
+}
+
+void MaskPool::save(const string & filename, const CrtParams & crt) const
+{
+    lock_guard<mutex> lock(entries_mutex);
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) throw "Could not open file '" + filename + "'";
+    uint64_t t = crt.M, size = entries.size();
+    file.write(reinterpret_cast<const char *>(&t), sizeof(t));
+    file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    for (const auto & mask : entries)
+    {
+        mask.sender_pt.save(file);
+        mask.receiver_ct.save(file);
+    }
+}
+
+} // psi
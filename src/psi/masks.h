@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "crt.h"
+#include "seal/seal.h"
+
+namespace psi
+{
+
+// Entries that do not depend on the query, made ahead of time, up to 'depth' of them, while their owner is idle.
+// Each entry is used once: 'take' removes it
+template <class Entry>
+class Pool
+{
+    public:
+        using Maker = std::function<void(Entry &)>;
+
+    protected:
+        uint64_t depth;
+        uint64_t low_watermark = 0; // fewest entries left since the last reset
+        uint64_t misses = 0; // entries requested from an empty pool since the last reset
+        uint64_t pending = 0; // entries being made by the filler
+        std::deque<Entry> entries;
+        mutable std::mutex entries_mutex;
+        std::atomic<bool> stopping{false};
+        std::thread filler;
+
+    public:
+        Pool(uint64_t depth) : depth(depth) {}
+        Pool(const Pool &) = delete;
+        Pool & operator=(const Pool &) = delete;
+        ~Pool() { stop(); }
+
+        // makes entries with 'num_threads' threads until the pool is full or 'stop' is called
+        void fill(const Maker & maker, uint64_t num_threads);
+
+        // 'fill' in the background, what the maker refers to must outlive 'stop'
+        void start(Maker maker, uint64_t num_threads);
+        void stop();
+
+        // false if the pool is empty, and the caller makes the entry itself
+        bool take(Entry & entry);
+
+        uint64_t getDepth() const { return depth; }
+        uint64_t getLowWatermark() const;
+        uint64_t getMisses() const;
+        uint64_t size() const;
+        void resetWatermark();
+};
+
+// random values added to a result of computeIntersection, encoded for the Sender and encrypted under Receiver's key
+struct Mask
+{
+    seal::Plaintext sender_pt;
+    seal::Ciphertext receiver_ct;
+};
+
+void makeMask
+(
+    Mask & mask,
+    const math::CrtParams & crt,
+    const seal::BatchEncoder * sender_encoder_ptr,
+    const seal::BatchEncoder * receiver_encoder_ptr,
+    const seal::Encryptor * receiver_encryptor_ptr
+);
+
+// makeMask with these arguments, which must outlive the maker
+Pool<Mask>::Maker maskMaker
+(
+    const math::CrtParams & crt,
+    const seal::BatchEncoder * sender_encoder_ptr,
+    const seal::BatchEncoder * receiver_encoder_ptr,
+    const seal::Encryptor * receiver_encryptor_ptr
+);
+
+// non-zero random values (modulo every CRT modulus) that recrypt multiplies a final result by, and its rotation
+struct RecryptMask
+{
+    seal::Plaintext receiver_pt;
+    uint64_t steps = 0;
+};
+
+void makeRecryptMask(RecryptMask & mask, const math::CrtParams & crt, const seal::BatchEncoder * receiver_encoder_ptr);
+
+// makeRecryptMask with these arguments, which must outlive the maker
+Pool<RecryptMask>::Maker recryptMaskMaker(const math::CrtParams & crt, const seal::BatchEncoder * receiver_encoder_ptr);
+
+// The Receiver's masks for computeIntersection, kept across runs: 'load' deletes the file so a crash cannot reuse them
+class MaskPool : public Pool<Mask>
+{
+    public:
+        using Pool<Mask>::Pool;
+
+        // the file holds t and the masks; a missing, unreadable or mismatched file leaves the pool empty
+        void load(const std::string & filename, const math::CrtParams & crt, const seal::SEALContext * sender_context_ptr, const seal::SEALContext * receiver_context_ptr);
+        void save(const std::string & filename, const math::CrtParams & crt) const;
+};
+
+// The Sender's masks for recrypt, made between sets so the online recrypt only decrypts, subtracts, multiplies, rotates
+// and switches modulus
+using RecryptPool = Pool<RecryptMask>;
+
+template <class Entry>
+void Pool<Entry>::fill(const Maker & maker, uint64_t num_threads)
+{
+    num_threads = std::max<uint64_t>(1, std::min(num_threads, depth));
+    std::vector<std::thread> threads(num_threads);
+    for (auto & thread : threads)
+    {
+        thread = std::thread([this, &maker]()
+        {
+            while (!stopping)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(entries_mutex);
+                    if (entries.size() + pending >= depth) return;
+                    pending++;
+                }
+                Entry entry;
+                maker(entry);
+                std::lock_guard<std::mutex> lock(entries_mutex);
+                entries.push_back(std::move(entry));
+                pending--;
+            }
+        });
+    }
+    for (auto & thread : threads) thread.join();
+}
+
+template <class Entry>
+void Pool<Entry>::start(Maker maker, uint64_t num_threads)
+{
+    stop();
+    stopping = false;
+    filler = std::thread([this, maker = std::move(maker), num_threads]() { fill(maker, num_threads); });
+}
+
+template <class Entry>
+void Pool<Entry>::stop()
+{
+    stopping = true;
+    if (filler.joinable()) filler.join();
+}
+
+template <class Entry>
+bool Pool<Entry>::take(Entry & entry)
+{
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    if (entries.empty()) { misses++; return false; }
+    entry = std::move(entries.front());
+    entries.pop_front();
+    low_watermark = std::min<uint64_t>(low_watermark, entries.size());
+    return true;
+}
+
+template <class Entry>
+uint64_t Pool<Entry>::getLowWatermark() const
+{
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    return low_watermark;
+}
+
+template <class Entry>
+uint64_t Pool<Entry>::getMisses() const
+{
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    return misses;
+}
+
+template <class Entry>
+uint64_t Pool<Entry>::size() const
+{
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    return entries.size();
+}
+
+template <class Entry>
+void Pool<Entry>::resetWatermark()
+{
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    low_watermark = entries.size();
+    misses = 0;
+}
+
+} // psi
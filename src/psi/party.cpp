@@ -7,6 +7,7 @@
 #include <vector>
 #include <unordered_set>
 #include "math.h"
+#include "random.h"
 
 using namespace std;
 
@@ -20,14 +21,13 @@ Party::Party(const string & filename)
     ifstream file(filename);
     if (!file.is_open()) throw "Could not open file '" + filename + "'";
     for (uint64_t value; file >> value;) set.push_back(value);
-    uint64_t max_value = *max_element(set.begin(), set.end());
+    uint64_t max_value = set.empty() ? 0 : *max_element(set.begin(), set.end());
     this->bitsize = math::clog2(max_value);
 }
 
 Party::Party(uint64_t num_entries, uint64_t bitsize)
 {
-    random_device rd;
-    mt19937 gen(rd());
+    auto & gen = math::generator();
     uint64_t max_value = math::shiftLeft(1ULL, bitsize) - 1ULL;
     uniform_int_distribution<uint64_t> dist(0ULL, max_value);
 
@@ -41,8 +41,7 @@ Party::Party(uint64_t num_entries, uint64_t bitsize)
 
 Party::Party(uint64_t num_entries, uint64_t bitsize, const vector<uint64_t> & source_set, double source_probability)
 {
-    random_device rd;
-    mt19937 gen(rd());
+    auto & gen = math::generator();
     uint64_t max_value = math::shiftLeft(1ULL, bitsize) - 1ULL;
     uniform_int_distribution<uint64_t> dist(0ULL, max_value);
     uniform_int_distribution<uint64_t> dist_idx(0, source_set.size()-1);
@@ -61,6 +60,12 @@ Party::Party(uint64_t num_entries, uint64_t bitsize, const vector<uint64_t> & so
     this->bitsize = bitsize;
 }
 
+Party::Party(const vector<uint64_t> & set, uint64_t bitsize)
+{
+    this->set = set;
+    this->bitsize = bitsize;
+}
+
 uint64_t Party::getBitSize() const
 {
     return bitsize;
@@ -18,6 +18,7 @@ class Party
         Party(const std::string & filename);
         Party(uint64_t num_entries, uint64_t bitsize);
         Party(uint64_t num_entries, uint64_t bitsize, const std::vector<uint64_t> & source_set, double source_probability = 0.5);
+        Party(const std::vector<uint64_t> & set, uint64_t bitsize);
 
         uint64_t getBitSize() const;
         const std::vector<uint64_t> & getSet() const;
@@ -1,26 +1,57 @@
 #include "psi.h"
 
+#include <algorithm>
 #include <cstdint>
-#include <random>
-#include <thread>
+#include <map>
 #include <vector>
 #include "bfv.h"
 #include "crt.h"
+#include "executor.h"
 #include "kuckoo.h"
+#include "masks.h"
 #include "packing.h"
 #include "party.h"
-#include "random.h"
+#include "product.h"
 #include "seal/seal.h"
+#include "stash.h"
 
 using namespace cuckoo;
 using namespace fhe;
 using namespace math;
+using namespace parallel;
 using namespace seal;
 using namespace std;
 
 namespace psi
 {
 
+// a column reveals a match with a single zero CRT component, except the stash column which needs 'stash_repetitions' zeros;
+// tested on the packed slot values, without decoding them
+static bool isMatch(const vector<uint64_t> & vpack, const CrtParams & crt, bool stash_column, uint64_t stash_repetitions)
+{
+    uint64_t threshold = stash_column ? stash_repetitions : 1;
+    return crtCountZeros(vpack.data(), vpack.size(), crt, threshold) == threshold;
+}
+
+// adds random values to a result under Sender's key and returns them under Receiver's key, taken from the pool if it has any
+static void addMask
+(
+    Ciphertext & result,
+    Ciphertext & random,
+    const CrtParams & crt,
+    MaskPool * masks,
+    const BatchEncoder * sender_encoder_ptr,
+    const Evaluator * sender_evaluator_ptr,
+    const BatchEncoder * receiver_encoder_ptr,
+    const Encryptor * receiver_encryptor_ptr
+)
+{
+    Mask mask;
+    if (!masks || !masks->take(mask)) makeMask(mask, crt, sender_encoder_ptr, receiver_encoder_ptr, receiver_encryptor_ptr);
+    sender_evaluator_ptr->add_plain_inplace(result, mask.sender_pt);
+    random = move(mask.receiver_ct);
+}
+
 void computeIntersection // single-thread
 (
     vector<vector<Ciphertext>> & results, // return masked intersection under Sender's key
@@ -28,8 +59,10 @@ void computeIntersection // single-thread
     const Party & receiver,
     const Kuckoo & cuckoo,
     const vector<Ciphertext> & encrypted_table,
+    bool presubtracted,
     const CrtParams & crt,
     uint64_t sender_eta,
+    const ProductPlan & sender_product,
     const SEALContext * sender_context_ptr,
     const BatchEncoder * sender_encoder_ptr,
     const Evaluator * sender_evaluator_ptr,
@@ -41,19 +74,27 @@ void computeIntersection // single-thread
 {
     const auto & receiver_set = receiver.getSet();
     const uint64_t num_hashes = cuckoo.getNumHashes();
-    const uint64_t k = crt.mi.size();
+    const uint64_t bin_width = cuckoo.getBinWidth();
     const uint64_t sender_n = sender_encoder_ptr->slot_count();
-    const uint64_t receiver_n = receiver_encoder_ptr->slot_count();
     const uint64_t return_width = sender_eta + 1;
+    const auto stash = stashLayout(cuckoo, crt, sender_n);
+    const uint64_t stash_width = bool(stash.size); // the stash check is an extra column
 
-    results.resize(receiver_set.size(), vector<Ciphertext>(return_width));
-    randoms.resize(receiver_set.size(), vector<Ciphertext>(return_width));
+    results.resize(receiver_set.size(), vector<Ciphertext>(return_width + stash_width));
+    randoms.resize(receiver_set.size(), vector<Ciphertext>(return_width + stash_width));
+
+    // hash the whole set at once
+    const uint64_t count = receiver_set.size();
+    vector<uint64_t> y_rs(count), ct_pslots(count), indices(num_hashes * count);
+    cuckoo.getIndices(receiver_set.data(), count, y_rs.data(), ct_pslots.data(), indices.data());
+    const QueryEncoder query_encoder(crt, sender_encoder_ptr, receiver_dummy); // the query plaintexts differ from all-dummy in one bin
 
     // for each entry in Receiver's set
     for (uint64_t i=0; i<receiver_set.size(); i++)
     {
         const auto & entry = receiver_set[i];
-        auto [y_r, ct_pslot, indices] = cuckoo.getIndices(entry);
+        uint64_t y_r = y_rs[i];
+        uint64_t ct_pslot = ct_pslots[i];
 
         // create subtraction matrix
         vector<vector<Ciphertext>> subtractions(return_width);
@@ -67,39 +108,31 @@ void computeIntersection // single-thread
         // for each hash function, subtract the corresponding slot
         for (uint64_t j=0; j<num_hashes; j++)
         {
-            auto & index = indices[j];
+            uint64_t index = indices[j * count + i];
             // Create plaintext polynomial for subtraction
             uint64_t ct_index = index / sender_n;
             uint64_t ct_bslot = index % sender_n;
             auto & ct = encrypted_table[ct_index];
-            auto slot = ct_bslot * k + ct_pslot;
-            vector<uint64_t> v(k*sender_n, receiver_dummy);
-            v[slot] = y_r;
             Plaintext pt;
-            packEncode(pt, v, crt, sender_encoder_ptr);
+            if (presubtracted) query_encoder.encodeOffset(pt, ct_bslot, bin_width, ct_pslot, y_r); // every slot of the bin
+            else query_encoder.encode(pt, ct_bslot, bin_width, ct_pslot, y_r);
 
             // Homomorphically compute the difference
             sender_evaluator_ptr->sub_plain(ct, pt, subtractions[j % return_width][j / return_width]);
         }
 
-        for (uint64_t j=0; j<return_width; j++)
+        for (uint64_t j=0; j<return_width+stash_width; j++)
         {
             // Depth-optimized homomorphic multiplications respecting the partitioning parameter
-            sender_evaluator_ptr->multiply_many(subtractions[j], *sender_relinkeys_ptr, results[i][j]);
+            if (j < return_width) multiplyTree(subtractions[j], results[i][j], sender_product, sender_evaluator_ptr, sender_relinkeys_ptr);
+            else checkStash(results[i][j], entry, encrypted_table, stash, crt, sender_encoder_ptr, sender_evaluator_ptr);
 
-            // Add random values to the result
-            auto random_values = randomVector(receiver_n, 0, crt.M);
-            Plaintext sender_random_pt;
-            sender_encoder_ptr->encode(random_values, sender_random_pt);
-            sender_evaluator_ptr->add_plain_inplace(results[i][j], sender_random_pt);
+            // Add random values to the result, and encrypt them with Receiver's key
+            addMask(results[i][j], randoms[i][j], crt, nullptr, sender_encoder_ptr, sender_evaluator_ptr, receiver_encoder_ptr, receiver_encryptor_ptr);
 
-            // Modulus switch
+            // Modulus switch, and relinearize a lazy product at the lowest level
             sender_evaluator_ptr->mod_switch_to_inplace(results[i][j], sender_context_ptr->last_parms_id());
-
-            // Encrypt random values with Receiver's key
-            Plaintext receiver_random_pt;
-            receiver_encoder_ptr->encode(random_values, receiver_random_pt);
-            receiver_encryptor_ptr->encrypt_symmetric(receiver_random_pt, randoms[i][j]);
+            relinearizeProduct(results[i][j], sender_evaluator_ptr, sender_relinkeys_ptr);
         }
     }
 }
@@ -111,8 +144,10 @@ void computeIntersection // multi-thread
     const Party & receiver,
     const Kuckoo & cuckoo,
     const vector<Ciphertext> & encrypted_table,
+    bool presubtracted,
     const CrtParams & crt,
     uint64_t sender_eta,
+    const ProductPlan & sender_product,
     const SEALContext * sender_context_ptr,
     const BatchEncoder * sender_encoder_ptr,
     const Evaluator * sender_evaluator_ptr,
@@ -120,126 +155,320 @@ void computeIntersection // multi-thread
     const BatchEncoder * receiver_encoder_ptr,
     const Encryptor * receiver_encryptor_ptr,
     uint64_t receiver_dummy,
+    MaskPool * masks,
     uint64_t num_threads
 )
 {
     const auto & receiver_set = receiver.getSet();
+    const uint64_t num_hashes = cuckoo.getNumHashes();
+    const uint64_t bin_width = cuckoo.getBinWidth();
+    const uint64_t sender_n = sender_encoder_ptr->slot_count();
+    const uint64_t return_width = sender_eta + 1;
+    const auto stash = stashLayout(cuckoo, crt, sender_n);
+    const uint64_t stash_width = bool(stash.size); // the stash check is an extra column
+
+    results.resize(receiver_set.size(), vector<Ciphertext>(return_width + stash_width));
+    randoms.resize(receiver_set.size(), vector<Ciphertext>(return_width + stash_width));
+
+    // hash the whole set at once
+    const uint64_t count = receiver_set.size();
+    vector<uint64_t> y_rs(count), ct_pslots(count), indices(num_hashes * count);
+    cuckoo.getIndices(receiver_set.data(), count, y_rs.data(), ct_pslots.data(), indices.data());
+    const QueryEncoder query_encoder(crt, sender_encoder_ptr, receiver_dummy); // the query plaintexts differ from all-dummy in one bin
+
+    // one task per entry in Receiver's set, which runs one task per (entry, hash) subtraction and then one per column
+    auto & pool = executor(num_threads);
+    pool.parallelFor(count, [
+        &pool, &results, &randoms, &receiver_set, &encrypted_table, &crt, return_width, count, num_hashes, bin_width, sender_n, &y_rs, &ct_pslots, &indices,
+        &query_encoder, presubtracted, &stash, stash_width, sender_context_ptr, sender_encoder_ptr, sender_evaluator_ptr, &sender_product, sender_relinkeys_ptr, receiver_encoder_ptr, receiver_encryptor_ptr, masks
+    ](uint64_t i)
+    {
+        const auto & entry = receiver_set[i];
+        uint64_t y_r = y_rs[i];
+        uint64_t ct_pslot = ct_pslots[i];
+
+        // create subtraction matrix
+        vector<vector<Ciphertext>> subtractions(return_width);
+        {   
+            // resize subtractions to make multiply_many easy with partitioning parameter
+            uint64_t subtraction_size = num_hashes / return_width;
+            uint64_t subtraction_remainder = num_hashes % return_width;
+            for (uint64_t j=0; j<return_width; j++) subtractions[j].resize(subtraction_size + bool(j < subtraction_remainder));
+        }
+
+        // Homomorphic subtraction, for each hash function
+        pool.parallelFor(num_hashes, [
+            i, count, return_width, &subtractions, y_r, ct_pslot, &indices, &encrypted_table, &query_encoder, presubtracted, sender_evaluator_ptr, bin_width, sender_n
+        ](uint64_t j)
+        {
+            // Create plaintext polynomial for subtraction
+            uint64_t index = indices[j * count + i];
+            uint64_t ct_index = index / sender_n;
+            uint64_t ct_bslot = index % sender_n;
+            auto & ct = encrypted_table[ct_index];
+            Plaintext pt;
+            if (presubtracted) query_encoder.encodeOffset(pt, ct_bslot, bin_width, ct_pslot, y_r); // every slot of the bin
+            else query_encoder.encode(pt, ct_bslot, bin_width, ct_pslot, y_r);
+
+            // Homomorphically compute the difference
+            sender_evaluator_ptr->sub_plain(ct, pt, subtractions[j % return_width][j / return_width]);
+        });
+
+        // Homomorphic multiplication and randomness addition, for each column
+        pool.parallelFor(return_width + stash_width, [
+            &results, &randoms, i, &entry, &subtractions, &encrypted_table, &stash, &crt, return_width,
+            sender_context_ptr, sender_encoder_ptr, sender_evaluator_ptr, &sender_product, sender_relinkeys_ptr, receiver_encoder_ptr, receiver_encryptor_ptr, masks
+        ](uint64_t j)
+        {
+            // Depth-optimized homomorphic multiplications respecting the partitioning parameter
+            if (j < return_width) multiplyTree(subtractions[j], results[i][j], sender_product, sender_evaluator_ptr, sender_relinkeys_ptr);
+            else checkStash(results[i][j], entry, encrypted_table, stash, crt, sender_encoder_ptr, sender_evaluator_ptr);
+
+            // Add random values to the result, and encrypt them with Receiver's key
+            addMask(results[i][j], randoms[i][j], crt, masks, sender_encoder_ptr, sender_evaluator_ptr, receiver_encoder_ptr, receiver_encryptor_ptr);
+
+            // Modulus switch, and relinearize a lazy product at the lowest level
+            sender_evaluator_ptr->mod_switch_to_inplace(results[i][j], sender_context_ptr->last_parms_id());
+            relinearizeProduct(results[i][j], sender_evaluator_ptr, sender_relinkeys_ptr);
+        });
+    });
+}
+
+QueryPlan planQueries(const Party & receiver, const Kuckoo & cuckoo, const CrtParams & crt, uint64_t n)
+{
+    const auto & receiver_set = receiver.getSet();
+    const uint64_t count = receiver_set.size();
+    const uint64_t num_hashes = cuckoo.getNumHashes();
+    const uint64_t bin_width = cuckoo.getBinWidth();
+    const uint64_t k = crt.mi.size();
+
+    vector<uint64_t> y_rs(count), ct_pslots(count), indices(num_hashes * count);
+    cuckoo.getIndices(receiver_set.data(), count, y_rs.data(), ct_pslots.data(), indices.data());
+
+    QueryPlan plan;
+    map<pair<uint64_t, vector<uint64_t>>, uint64_t> row_index; // by round and table ciphertexts
+    vector<uint64_t> cells, cts(num_hashes), slots(num_hashes);
+    for (uint64_t i=0; i<count; i++)
+    {
+        // the cells of every bin of the element
+        cells.clear();
+        for (uint64_t j=0; j<num_hashes; j++)
+        {
+            uint64_t index = indices[j * count + i];
+            cts[j] = index / n;
+            slots[j] = index % n;
+            for (uint64_t w=0; w<bin_width; w++) cells.push_back((slots[j] + w) * k + ct_pslots[i]);
+        }
+
+        // first round where they are free (two hash functions may give the element the same cell)
+        auto isFree = [&plan, &cells, i](uint64_t r)
+        {
+            const auto & owners = plan.rounds[r].owners;
+            return all_of(cells.begin(), cells.end(), [&owners, i](uint64_t c) { return !owners[c] || owners[c] == i+1; });
+        };
+        uint64_t r = 0;
+        while (r < plan.rounds.size() && !isFree(r)) r++;
+        if (r == plan.rounds.size()) plan.rounds.push_back({vector<uint64_t>(k*n, 0), {}});
+
+        auto & round = plan.rounds[r];
+        for (auto c : cells) round.owners[c] = i+1;
+        for (uint64_t j=0; j<num_hashes; j++)
+        {
+            bool repeated = false;
+            for (uint64_t l=0; l<j; l++) repeated |= cts[l] == cts[j] && slots[l] == slots[j];
+            if (!repeated) round.queries[cts[j]].push_back({slots[j], ct_pslots[i], y_rs[i]});
+        }
+        if (row_index.emplace(make_pair(r, cts), plan.rows.size()).second) plan.rows.push_back({r, cts});
+    }
+    return plan;
+}
+
+void computeIntersection // multi-query packing, multi-thread
+(
+    vector<vector<Ciphertext>> & results,
+    vector<vector<Ciphertext>> & randoms,
+    const QueryPlan & plan,
+    const Kuckoo & cuckoo,
+    const vector<Ciphertext> & encrypted_table,
+    bool presubtracted,
+    const CrtParams & crt,
+    uint64_t sender_eta,
+    const ProductPlan & sender_product,
+    const SEALContext * sender_context_ptr,
+    const BatchEncoder * sender_encoder_ptr,
+    const Evaluator * sender_evaluator_ptr,
+    const RelinKeys * sender_relinkeys_ptr,
+    const BatchEncoder * receiver_encoder_ptr,
+    const Encryptor * receiver_encryptor_ptr,
+    uint64_t receiver_dummy,
+    MaskPool * masks,
+    uint64_t num_threads
+)
+{
+    if (stashLayout(cuckoo, crt, sender_encoder_ptr->slot_count()).size) throw "Multi-query packing does not support a stash";
+
+    const uint64_t num_hashes = cuckoo.getNumHashes();
+    const uint64_t bin_width = cuckoo.getBinWidth();
     const uint64_t return_width = sender_eta + 1;
+    const QueryEncoder query_encoder(crt, sender_encoder_ptr, receiver_dummy);
+    auto & pool = executor(num_threads);
 
-    results.resize(receiver_set.size(), vector<Ciphertext>(return_width));
-    randoms.resize(receiver_set.size(), vector<Ciphertext>(return_width));
+    results.resize(plan.rows.size(), vector<Ciphertext>(return_width));
+    randoms.resize(plan.rows.size(), vector<Ciphertext>(return_width));
 
-    uint64_t outer_threads = min(num_threads, receiver_set.size());
-    uint64_t inner_threads = num_threads / outer_threads + bool(num_threads % outer_threads);
+    vector<vector<uint64_t>> round_rows(plan.rounds.size());
+    for (uint64_t i=0; i<plan.rows.size(); i++) round_rows[plan.rows[i].round].push_back(i);
 
-    vector<thread> threads(outer_threads);
-    for (uint64_t t=0; t<outer_threads; t++)
+    for (uint64_t r=0; r<plan.rounds.size(); r++)
     {
-        threads[t] = thread
-        ([
-            t, outer_threads, inner_threads, &results, &randoms, &receiver_set, &cuckoo, &encrypted_table, &crt, return_width,
-            sender_context_ptr, sender_encoder_ptr, sender_evaluator_ptr, sender_relinkeys_ptr, receiver_encoder_ptr, receiver_encryptor_ptr, receiver_dummy
-        ]()
+        // one subtraction per table ciphertext, with the bins of every element of the round
+        const auto & queries = plan.rounds[r].queries;
+        vector<uint64_t> cts;
+        for (const auto & entry : queries) cts.push_back(entry.first);
+        vector<Ciphertext> differences(cts.size());
+        pool.parallelFor(cts.size(), [&differences, &cts, &queries, &encrypted_table, presubtracted, &query_encoder, sender_evaluator_ptr, bin_width](uint64_t l)
+        {
+            const auto & ct_queries = queries.at(cts[l]);
+            const auto & first = ct_queries[0];
+            Plaintext pt;
+            if (presubtracted) query_encoder.encodeOffset(pt, first.slot, bin_width, first.component, first.value);
+            else query_encoder.encode(pt, first.slot, bin_width, first.component, first.value);
+            for (uint64_t q=1; q<ct_queries.size(); q++)
+                query_encoder.addOffset(pt, ct_queries[q].slot, bin_width, ct_queries[q].component, ct_queries[q].value);
+            sender_evaluator_ptr->sub_plain(encrypted_table[cts[l]], pt, differences[l]);
+        });
+
+        // the rows of the round multiply the differences of their ciphertexts, one task per (row, column)
+        const auto & rows = round_rows[r];
+        pool.parallelFor(rows.size() * return_width,
+        [
+            &results, &randoms, &plan, &rows, &cts, &differences, &crt, num_hashes, return_width,
+            sender_context_ptr, sender_encoder_ptr, sender_evaluator_ptr, &sender_product, sender_relinkeys_ptr, receiver_encoder_ptr, receiver_encryptor_ptr, masks
+        ](uint64_t l)
         {
-            const uint64_t num_hashes = cuckoo.getNumHashes();
+            uint64_t i = rows[l / return_width], j = l % return_width;
 
-             // for each entry in Receiver's set
-            for (uint64_t i=t; i<receiver_set.size(); i+=outer_threads)
+            // the column of the subtraction matrix respecting the partitioning parameter
+            vector<Ciphertext> subtractions;
+            for (uint64_t h=j; h<num_hashes; h+=return_width)
             {
-                const auto & entry = receiver_set[i];
-                auto [y_r, ct_pslot, indices] = cuckoo.getIndices(entry);
-
-                // create subtraction matrix
-                vector<vector<Ciphertext>> subtractions(return_width);
-                {   
-                    // resize subtractions to make multiply_many easy with partitioning parameter
-                    uint64_t subtraction_size = num_hashes / return_width;
-                    uint64_t subtraction_remainder = num_hashes % return_width;
-                    for (uint64_t j=0; j<return_width; j++) subtractions[j].resize(subtraction_size + bool(j < subtraction_remainder));
-                }
-
-                {
-                    // Homomorphic subtraction
-                    uint64_t internal_threads = min(inner_threads, num_hashes);
-                    vector<thread> threads(internal_threads);
-                    for (uint64_t u=0; u<internal_threads; u++)
-                    {
-                        threads[u] = thread
-                        ([
-                            u, internal_threads, &subtractions, &y_r, &ct_pslot, &indices, &encrypted_table,
-                            &crt, &sender_encoder_ptr, &sender_evaluator_ptr, receiver_dummy
-                        ]()
-                        {
-                            const uint64_t num_hashes = indices.size();
-                            const uint64_t k = crt.mi.size();
-                            const uint64_t sender_n = sender_encoder_ptr->slot_count();
-                            const uint64_t return_width = subtractions.size();
-
-                            // for each hash function, subtract the corresponding slot
-                            for (uint64_t j=u; j<num_hashes; j+=internal_threads)
-                            {
-                                // Create plaintext polynomial for subtraction
-                                auto & index = indices[j];
-                                uint64_t ct_index = index / sender_n;
-                                uint64_t ct_bslot = index % sender_n;
-                                auto & ct = encrypted_table[ct_index];
-                                auto slot = ct_bslot * k + ct_pslot;
-                                vector<uint64_t> v(k*sender_n, receiver_dummy);
-                                v[slot] = y_r;
-                                Plaintext pt;
-                                packEncode(pt, v, crt, sender_encoder_ptr);
-
-                                // Homomorphically compute the difference
-                                sender_evaluator_ptr->sub_plain(ct, pt, subtractions[j % return_width][j / return_width]);
-                            }
-                        });
-                    }
-                    for (auto & thread : threads) thread.join();
-                }
-
-                {
-                    // Homomorphic multiplication and randomness addition
-                    uint64_t internal_threads = min(inner_threads, return_width);
-                    vector<thread> threads(internal_threads);
-                    for (uint64_t u=0; u<internal_threads; u++)
-                    {
-                        threads[u] = thread(
-                        [
-                            u, internal_threads, &results, &randoms, i, &subtractions, &crt,
-                            &sender_context_ptr, &sender_encoder_ptr, &sender_evaluator_ptr, &sender_relinkeys_ptr,
-                            &receiver_encoder_ptr, &receiver_encryptor_ptr
-                        ]()
-                        {
-                            const uint64_t receiver_n = receiver_encoder_ptr->slot_count();
-                            const uint64_t return_width = subtractions.size();
-
-                            for (uint64_t j=u; j<return_width; j+=internal_threads)
-                            {
-                                // Depth-optimized homomorphic multiplications respecting the partitioning parameter
-                                sender_evaluator_ptr->multiply_many(subtractions[j], *sender_relinkeys_ptr, results[i][j]);
-
-                                // Add random values to the result
-                                auto random_values = randomVector(receiver_n, 0, crt.M);
-                                Plaintext sender_random_pt;
-                                sender_encoder_ptr->encode(random_values, sender_random_pt);
-                                sender_evaluator_ptr->add_plain_inplace(results[i][j], sender_random_pt);
-
-                                // Modulus switch
-                                sender_evaluator_ptr->mod_switch_to_inplace(results[i][j], sender_context_ptr->last_parms_id());
-
-                                // Encrypt random values with Receiver's key
-                                Plaintext receiver_random_pt;
-                                receiver_encoder_ptr->encode(random_values, receiver_random_pt);
-                                receiver_encryptor_ptr->encrypt_symmetric(receiver_random_pt, randoms[i][j]);
-                            }
-                        });
-                    }
-                    for (auto & thread : threads) thread.join();
-                }
+                uint64_t position = lower_bound(cts.begin(), cts.end(), plan.rows[i].cts[h]) - cts.begin();
+                subtractions.push_back(differences[position]);
             }
+
+            // Depth-optimized homomorphic multiplications
+            multiplyTree(subtractions, results[i][j], sender_product, sender_evaluator_ptr, sender_relinkeys_ptr);
+
+            // Add random values to the result, and encrypt them with Receiver's key
+            addMask(results[i][j], randoms[i][j], crt, masks, sender_encoder_ptr, sender_evaluator_ptr, receiver_encoder_ptr, receiver_encryptor_ptr);
+
+            // Modulus switch, and relinearize a lazy product at the lowest level
+            sender_evaluator_ptr->mod_switch_to_inplace(results[i][j], sender_context_ptr->last_parms_id());
+            relinearizeProduct(results[i][j], sender_evaluator_ptr, sender_relinkeys_ptr);
         });
     }
-    for (auto & thread : threads) thread.join();
+}
+
+void encryptTable // multi-thread
+(
+    vector<Ciphertext> & encrypted_table,
+    const Kuckoo & cuckoo,
+    const CrtParams & crt,
+    const BatchEncoder * encoder_ptr,
+    const Encryptor * encryptor_ptr,
+    uint64_t num_threads
+)
+{
+    const uint64_t n = encoder_ptr->slot_count();
+    const uint64_t table_size = cuckoo.getTableSize();
+    const uint64_t size = table_size / n + bool(table_size % n) + stashLayout(cuckoo, crt, n).num_chunks;
+
+    vector<uint64_t> indices(size);
+    for (uint64_t i=0; i<size; i++) indices[i] = i;
+    encryptTable(encrypted_table, cuckoo, crt, encoder_ptr, encryptor_ptr, indices, num_threads);
+}
+
+void encryptTable // multi-thread
+(
+    vector<Ciphertext> & encrypted_table,
+    const Kuckoo & cuckoo,
+    const CrtParams & crt,
+    const BatchEncoder * encoder_ptr,
+    const Encryptor * encryptor_ptr,
+    const vector<uint64_t> & indices,
+    uint64_t num_threads
+)
+{
+    const uint64_t k = crt.mi.size();
+    const uint64_t n = encoder_ptr->slot_count();
+    const uint64_t table_size = cuckoo.getTableSize();
+    const uint64_t table_cts = table_size / n + bool(table_size % n);
+
+    // the stash ciphertexts follow the table ones, and are encrypted together
+    vector<Ciphertext> encrypted_stash(stashLayout(cuckoo, crt, n).num_chunks);
+    if (any_of(indices.begin(), indices.end(), [table_cts](uint64_t i) { return i >= table_cts; }))
+        encryptStash(encrypted_stash, cuckoo, crt, encoder_ptr, encryptor_ptr);
+    encrypted_table.resize(table_cts + encrypted_stash.size());
+
+    // the slots of each ciphertext are read straight from the packed table
+    executor(num_threads).parallelFor(indices.size(), [&encrypted_table, &encrypted_stash, &cuckoo, &indices, &crt, encoder_ptr, encryptor_ptr, k, n, table_cts](uint64_t u)
+    {
+        uint64_t i = indices[u];
+        if (i >= table_cts) { encrypted_table[i] = encrypted_stash[i - table_cts]; return; }
+        vector<uint64_t> vs(k*n, 0);
+        cuckoo.getSlots(i*n, vs);
+        packEncrypt(encrypted_table[i], vs, crt, encoder_ptr, encryptor_ptr);
+    });
+}
+
+void presubtractTable // multi-thread
+(
+    vector<Ciphertext> & encrypted_table,
+    const Kuckoo & cuckoo,
+    const CrtParams & crt,
+    const BatchEncoder * sender_encoder_ptr,
+    const Evaluator * sender_evaluator_ptr,
+    uint64_t receiver_dummy,
+    const vector<uint64_t> & indices,
+    uint64_t num_threads
+)
+{
+    const uint64_t k = crt.mi.size();
+    const uint64_t n = sender_encoder_ptr->slot_count();
+    // the Receiver's table only knows the public parameters, so the stash ciphertexts at the end are counted instead
+    const uint64_t table_cts = encrypted_table.size() - stashLayout(cuckoo, crt, n).num_chunks;
+
+    // every query plaintext is this one except for the slots of one bin
+    Plaintext dummy_pt;
+    packEncode(dummy_pt, vector<uint64_t>(k*n, receiver_dummy), crt, sender_encoder_ptr);
+
+    executor(num_threads).parallelFor(indices.size(), [&encrypted_table, &indices, &dummy_pt, sender_evaluator_ptr, table_cts](uint64_t u)
+    {
+        if (indices[u] < table_cts) sender_evaluator_ptr->sub_plain_inplace(encrypted_table[indices[u]], dummy_pt);
+    });
+}
+
+void switchTable // multi-thread
+(
+    vector<Ciphertext> & encrypted_table,
+    const Kuckoo & cuckoo,
+    const CrtParams & crt,
+    const BatchEncoder * sender_encoder_ptr,
+    const Evaluator * sender_evaluator_ptr,
+    const parms_id_type & level,
+    const vector<uint64_t> & indices,
+    uint64_t num_threads
+)
+{
+    // the level is planned for the hash product only, not for the random weights checkStash multiplies the stash by
+    const uint64_t table_cts = encrypted_table.size() - stashLayout(cuckoo, crt, sender_encoder_ptr->slot_count()).num_chunks;
+
+    executor(num_threads).parallelFor(indices.size(), [&encrypted_table, &level, &indices, sender_evaluator_ptr, table_cts](uint64_t u)
+    {
+        if (indices[u] >= table_cts) return;
+        auto & ct = encrypted_table[indices[u]];
+        if (ct.parms_id() != level) sender_evaluator_ptr->mod_switch_to_inplace(ct, level);
+    });
 }
 
 vector<uint64_t> decryptIntersection // single-thread
@@ -248,18 +477,19 @@ vector<uint64_t> decryptIntersection // single-thread
     const Party & receiver,
     const CrtParams & crt,
     const BatchEncoder * receiver_encoder_ptr,
-    Decryptor * receiver_decryptor_ptr
+    Decryptor * receiver_decryptor_ptr,
+    uint64_t stash_repetitions
 )
 {
-    vector<bool> flag(receiver.getSet().size(), false);
+    vector<uint8_t> flag(receiver.getSet().size(), false);
+    Plaintext pt;
+    vector<uint64_t> vpack;
     for (uint64_t i=0; i<finals.size(); i++)
     {
         for (uint64_t j=0; j<finals[i].size(); j++)
         {
-            auto final_values = packDecrypt(finals[i][j], crt, receiver_encoder_ptr, receiver_decryptor_ptr);
-            for (auto & value : final_values)
-                if (!value) { flag[i] = true; break; }
-            if (flag[i]) break;
+            packDecryptSlots(finals[i][j], pt, vpack, receiver_encoder_ptr, receiver_decryptor_ptr);
+            if (isMatch(vpack, crt, stash_repetitions && (j+1 == finals[i].size()), stash_repetitions)) { flag[i] = true; break; }
         }
     }
 
@@ -276,48 +506,64 @@ vector<uint64_t> decryptIntersection // multi-thread
     const CrtParams & crt,
     const BatchEncoder * receiver_encoder_ptr,
     Decryptor * receiver_decryptor_ptr,
+    uint64_t stash_repetitions,
     uint64_t num_threads
 )
 {
-    vector<bool> flag(receiver.getSet().size(), false);
+    // one entry per final ciphertext, each written by a single task
+    const uint64_t width = finals.empty() ? 0 : finals[0].size();
+    vector<uint8_t> hits(finals.size() * width, false);
+
+    executor(num_threads).parallelFor(hits.size(), [width, &hits, &finals, &crt, receiver_encoder_ptr, receiver_decryptor_ptr, stash_repetitions](uint64_t c)
+    {
+        uint64_t i = c / width, j = c % width;
+        Plaintext pt;
+        vector<uint64_t> vpack;
+        packDecryptSlots(finals[i][j], pt, vpack, receiver_encoder_ptr, receiver_decryptor_ptr);
+        hits[c] = isMatch(vpack, crt, stash_repetitions && (j+1 == width), stash_repetitions);
+    });
 
-    uint64_t outer_threads = min(num_threads, finals.size());
-    uint64_t inner_threads = num_threads / outer_threads + bool(num_threads % outer_threads);
+    vector<uint64_t> intersection;
+    for (uint64_t i=0; i<finals.size(); i++)
+        if (any_of(hits.begin() + i*width, hits.begin() + (i+1)*width, [](uint8_t hit) { return hit; }))
+            intersection.push_back(receiver.getSet()[i]);
+    return intersection;
+}
 
-    vector<thread> threads(outer_threads);
-    for (uint64_t t=0; t<outer_threads; t++)
+vector<uint64_t> decryptIntersection // multi-query packing, multi-thread
+(
+    const vector<vector<Ciphertext>> & finals,
+    const QueryPlan & plan,
+    const Party & receiver,
+    const CrtParams & crt,
+    const BatchEncoder * receiver_encoder_ptr,
+    Decryptor * receiver_decryptor_ptr,
+    uint64_t num_threads
+)
+{
+    // the owners are laid out over Sender's slots, which must be Receiver's ones too
+    for (const auto & round : plan.rounds)
+        if (round.owners.size() != crt.mi.size() * receiver_encoder_ptr->slot_count()) throw "Multi-query packing needs the same n for Sender and Receiver";
+
+    // each task collects the elements owning the zero cells of one final ciphertext
+    const uint64_t width = finals.empty() ? 0 : finals[0].size();
+    vector<vector<uint64_t>> matches(finals.size() * width);
+    executor(num_threads).parallelFor(matches.size(), [width, &matches, &finals, &plan, &crt, receiver_encoder_ptr, receiver_decryptor_ptr](uint64_t c)
     {
-        threads[t] = thread(
-        [
-            t, outer_threads, inner_threads, &flag, &finals, &receiver, &crt, &receiver_encoder_ptr, &receiver_decryptor_ptr
-        ]()
-        {
-            for (uint64_t i=t; i<finals.size(); i+=outer_threads)
-            {
-                uint64_t internal_threads = min(inner_threads, finals[i].size());
-
-                vector<thread> threads(internal_threads);
-                for (uint64_t u=0; u<internal_threads; u++)
-                {
-                    threads[u] = thread(
-                    [
-                        u, internal_threads, i, &flag, &finals, &receiver, &crt, &receiver_encoder_ptr, &receiver_decryptor_ptr
-                    ]()
-                    {
-                        for (uint64_t j=u; j<finals[i].size(); j+=internal_threads)
-                        {
-                            auto final_values = packDecrypt(finals[i][j], crt, receiver_encoder_ptr, receiver_decryptor_ptr);
-                            for (auto & value : final_values)
-                                if (!value) { flag[i] = true; break; }
-                            if (flag[i]) break;
-                        }
-                    });
-                }
-                for (auto & thread : threads) thread.join();
-            }
-        });
-    }
-    for (auto & thread : threads) thread.join();
+        const uint64_t k = crt.mi.size();
+        uint64_t i = c / width, j = c % width;
+        const auto & owners = plan.rounds[plan.rows[i].round].owners;
+        Plaintext pt;
+        vector<uint64_t> vpack;
+        packDecryptSlots(finals[i][j], pt, vpack, receiver_encoder_ptr, receiver_decryptor_ptr);
+        for (uint64_t s=0; s<vpack.size(); s++)
+            for (uint64_t l=0; l<k; l++)
+                if (owners[s*k+l] && crt.isZero(vpack[s], l)) matches[c].push_back(owners[s*k+l] - 1);
+    });
+
+    vector<uint8_t> flag(receiver.getSet().size(), false);
+    for (const auto & final_matches : matches)
+        for (auto i : final_matches) flag[i] = true;
 
     vector<uint64_t> intersection;
     for (uint64_t i=0; i<flag.size(); i++)
@@ -325,6 +571,22 @@ vector<uint64_t> decryptIntersection // multi-thread
     return intersection;
 }
 
+// multiplies a final result by non-zero random values, with a mask from the pool if it has any, and returns the rotation that goes with them
+static uint64_t multiplyMask
+(
+    Ciphertext & final,
+    const CrtParams & crt,
+    RecryptPool * masks,
+    const BatchEncoder * receiver_encoder_ptr,
+    const Evaluator * receiver_evaluator_ptr
+)
+{
+    RecryptMask mask;
+    if (!masks || !masks->take(mask)) makeRecryptMask(mask, crt, receiver_encoder_ptr);
+    receiver_evaluator_ptr->multiply_plain_inplace(final, mask.receiver_pt);
+    return mask.steps;
+}
+
 void recrypt // single-thread
 ( 
     vector<vector<Ciphertext>> & finals,
@@ -332,6 +594,9 @@ void recrypt // single-thread
     const vector<vector<Ciphertext>> & randoms,
     const CrtParams & crt,
     uint64_t receiver_eta,
+    const ProductPlan & receiver_product,
+    bool stash,
+    bool rotation,
     const BatchEncoder * sender_encoder_ptr,
     Decryptor * sender_decryptor_ptr,
     const SEALContext * receiver_context_ptr,
@@ -341,28 +606,25 @@ void recrypt // single-thread
     const GaloisKeys * receiver_galoiskeys_ptr
 )
 {
-    const uint64_t return_width = results[0].size();
+    const uint64_t return_width = results[0].size() - stash;
     const uint64_t final_width = receiver_eta + 1;
-    const uint64_t receiver_n = receiver_encoder_ptr->slot_count();
-
-    finals.resize(results.size(), vector<Ciphertext>(final_width));
 
-    random_device rd;
-    mt19937 gen(rd());
-    uniform_int_distribution<uint64_t> dist(0, receiver_n-1);
+    finals.resize(results.size(), vector<Ciphertext>(final_width + stash));
 
     for (uint64_t i=0; i<results.size(); i++)
     {
-        vector<vector<Ciphertext>> subtractions(final_width);
+        vector<vector<Ciphertext>> subtractions(final_width + stash);
         {
             // resize subtractions to make multiply_many easy with partitioning parameter
+            // the stash column is never multiplied, so it gets a group of its own
             uint64_t subtraction_size = return_width / final_width; 
             uint64_t subtraction_remainder = return_width % final_width;
             for (uint64_t j=0; j<final_width; j++) subtractions[j].resize(subtraction_size + bool(j < subtraction_remainder));
+            if (stash) subtractions[final_width].resize(1);
         }
 
         // Decrypt the result and subtract it from the random mask
-        for (uint64_t j=0; j<return_width; j++)
+        for (uint64_t j=0; j<results[i].size(); j++)
         {
             // Decrypt the result and encode it under Receiver's key
             Plaintext sender_result_pt, receiver_result_pt;
@@ -372,26 +634,26 @@ void recrypt // single-thread
             receiver_encoder_ptr->encode(sender_result, receiver_result_pt);
 
             // Subtract the random mask
-            receiver_evaluator_ptr->sub_plain(randoms[i][j], receiver_result_pt, subtractions[j % final_width][j / final_width]);
+            auto & subtraction = j < return_width ? subtractions[j % final_width][j / final_width] : subtractions[final_width][0];
+            receiver_evaluator_ptr->sub_plain(randoms[i][j], receiver_result_pt, subtraction);
         }
 
-        for (uint64_t j=0; j<final_width; j++)
+        for (uint64_t j=0; j<subtractions.size(); j++)
         {
             // Depth-optimized homomorphic multiplication respecting the partitioning parameter
-            receiver_evaluator_ptr->multiply_many(subtractions[j], *receiver_relinkeys_ptr, finals[i][j]);
+            multiplyTree(subtractions[j], finals[i][j], receiver_product, receiver_evaluator_ptr, receiver_relinkeys_ptr);
             
             // Multiply non-zero random values to the result
-            auto random_values = randomVector(receiver_n, 1, crt.M, crt.mi);
-            Plaintext receiver_random_pt;
-            receiver_encoder_ptr->encode(random_values, receiver_random_pt);
-            receiver_evaluator_ptr->multiply_plain_inplace(finals[i][j], receiver_random_pt);
+            uint64_t steps = multiplyMask(finals[i][j], crt, nullptr, receiver_encoder_ptr, receiver_evaluator_ptr);
 
-            // Rotate the result
-            uint64_t steps = dist(gen);
-            rotate(finals[i][j], steps, receiver_n, receiver_evaluator_ptr, receiver_galoiskeys_ptr);
-
-            // Modulus switch
-            receiver_evaluator_ptr->mod_switch_to_inplace(finals[i][j], receiver_context_ptr->last_parms_id());
+            // Rotate it and switch modulus; a lazy product is switched first, then relinearized and rotated at the lowest level
+            if (receiver_product.method == Product::lazy)
+            {
+                receiver_evaluator_ptr->mod_switch_to_inplace(finals[i][j], receiver_context_ptr->last_parms_id());
+                relinearizeProduct(finals[i][j], receiver_evaluator_ptr, receiver_relinkeys_ptr);
+            }
+            if (rotation) rotate(finals[i][j], steps, receiver_encoder_ptr->slot_count(), receiver_evaluator_ptr, receiver_galoiskeys_ptr);
+            if (receiver_product.method != Product::lazy) receiver_evaluator_ptr->mod_switch_to_inplace(finals[i][j], receiver_context_ptr->last_parms_id());
         }
     }
 }
@@ -403,6 +665,9 @@ void recrypt // multi-thread
     const vector<vector<Ciphertext>> & randoms,
     const CrtParams & crt,
     uint64_t receiver_eta,
+    const ProductPlan & receiver_product,
+    bool stash,
+    bool rotation,
     const BatchEncoder * sender_encoder_ptr,
     Decryptor * sender_decryptor_ptr,
     const SEALContext * receiver_context_ptr,
@@ -410,109 +675,88 @@ void recrypt // multi-thread
     const Evaluator * receiver_evaluator_ptr,
     const RelinKeys * receiver_relinkeys_ptr,
     const GaloisKeys * receiver_galoiskeys_ptr,
+    RecryptPool * masks,
     uint64_t num_threads
 )
 {
     const uint64_t final_width = receiver_eta + 1;
 
-    finals.resize(results.size(), vector<Ciphertext>(final_width));
+    finals.resize(results.size(), vector<Ciphertext>(final_width + stash));
 
-    uint64_t outer_threads = min(num_threads, results.size());
-    uint64_t inner_threads = num_threads / outer_threads + bool(num_threads % outer_threads);
-
-    vector<thread> threads(outer_threads);
-    for (uint64_t t=0; t<outer_threads; t++)
+    // every item is a graph of tasks: decrypt-and-subtract of each column -> product -> mask -> rotate -> mod-switch of each group
+    // (mod-switch before rotate for a lazy product);
+    // a group starts as soon as its own columns are subtracted, and the tasks of all items share the executor
+    vector<vector<vector<Ciphertext>>> subtractions(results.size(), vector<vector<Ciphertext>>(final_width + stash));
+    vector<vector<uint64_t>> steps(results.size(), vector<uint64_t>(final_width + stash));
+    TaskGraph graph;
+    for (uint64_t i=0; i<results.size(); i++)
     {
-        threads[t] = thread(
-        [
-            t, outer_threads, inner_threads, &finals, &results, &randoms, &crt, final_width, sender_encoder_ptr, sender_decryptor_ptr,
-            receiver_context_ptr, receiver_encoder_ptr, receiver_evaluator_ptr, receiver_relinkeys_ptr, receiver_galoiskeys_ptr
-        ]()
+        const uint64_t return_width = results[i].size() - stash;
         {
-            const uint64_t return_width = results[t].size();
+            // resize subtractions to make multiply_many easy with partitioning parameter
+            // the stash column is never multiplied, so it gets a group of its own
+            uint64_t subtraction_size = return_width / final_width; 
+            uint64_t subtraction_remainder = return_width % final_width;
+            for (uint64_t j=0; j<final_width; j++) subtractions[i][j].resize(subtraction_size + bool(j < subtraction_remainder));
+            if (stash) subtractions[i][final_width].resize(1);
+        }
 
-            for (uint64_t i=t; i<results.size(); i+=outer_threads)
+        vector<uint64_t> products(subtractions[i].size());
+        for (uint64_t j=0; j<subtractions[i].size(); j++)
+        {
+            // Depth-optimized homomorphic multiplication respecting the partitioning parameter
+            products[j] = graph.add([&finals, &subtractions, i, j, &receiver_product, receiver_evaluator_ptr, receiver_relinkeys_ptr]()
             {
-                vector<vector<Ciphertext>> subtractions(final_width);
-                {
-                    // resize subtractions to make multiply_many easy with partitioning parameter
-                    uint64_t subtraction_size = return_width / final_width; 
-                    uint64_t subtraction_remainder = return_width % final_width;
-                    for (uint64_t j=0; j<final_width; j++) subtractions[j].resize(subtraction_size + bool(j < subtraction_remainder));
-                }
-
-                // Homomorphic subtraction
-                {
-                    uint64_t internal_threads = min(inner_threads, return_width);
-                    vector<thread> threads(internal_threads);
-                    for (uint64_t u=0; u<internal_threads; u++)
-                    {
-                        threads[u] = thread(
-                        [
-                            u, internal_threads, &subtractions, &results, &randoms, i, final_width, return_width,
-                            &sender_decryptor_ptr, &sender_encoder_ptr, &receiver_encoder_ptr, &receiver_evaluator_ptr
-                        ]()
-                        {
-                            for (uint64_t j=u; j<return_width; j+=internal_threads)
-                            {
-                                // Decrypt the result and subtract it from the random mask
-                                Plaintext sender_result_pt, receiver_result_pt;
-                                vector<uint64_t> sender_result;
-                                sender_decryptor_ptr->decrypt(results[i][j], sender_result_pt);
-                                sender_encoder_ptr->decode(sender_result_pt, sender_result);
-                                receiver_encoder_ptr->encode(sender_result, receiver_result_pt);
-
-                                // Subtract the random mask
-                                receiver_evaluator_ptr->sub_plain(randoms[i][j], receiver_result_pt, subtractions[j % final_width][j / final_width]);
-                            }
-                        });
-                    }
-                    for (auto & thread : threads) thread.join();
-                }
-                
-                {
-                    uint64_t internal_threads = min(inner_threads, final_width);
-                    vector<thread> threads(internal_threads);
-                    for (uint64_t u=0; u<internal_threads; u++)
-                    {
-                        threads[u] = thread(
-                        [
-                            u, internal_threads, &finals, &subtractions, i, &crt, final_width, &receiver_context_ptr,
-                            &receiver_encoder_ptr, &receiver_evaluator_ptr, &receiver_relinkeys_ptr, &receiver_galoiskeys_ptr
-                        ]()
-                        {
-                            const uint64_t receiver_n = receiver_encoder_ptr->slot_count();
-
-                            random_device rd;
-                            mt19937 gen(rd());
-                            uniform_int_distribution<uint64_t> dist(0, receiver_n-1);
-
-                            for (uint64_t j=u; j<final_width; j+=internal_threads)
-                            {
-                                // Depth-optimized homomorphic multiplication respecting the partitioning parameter
-                                receiver_evaluator_ptr->multiply_many(subtractions[j], *receiver_relinkeys_ptr, finals[i][j]);
-
-                                // Multiply non-zero random values to the result
-                                auto random_values = randomVector(receiver_n, 1, crt.M, crt.mi);
-                                Plaintext receiver_random_pt;
-                                receiver_encoder_ptr->encode(random_values, receiver_random_pt);
-                                receiver_evaluator_ptr->multiply_plain_inplace(finals[i][j], receiver_random_pt);
-
-                                // Rotate the result
-                                uint64_t steps = dist(gen);
-                                rotate(finals[i][j], steps, receiver_n, receiver_evaluator_ptr, receiver_galoiskeys_ptr);
-
-                                // Modulus switch
-                                receiver_evaluator_ptr->mod_switch_to_inplace(finals[i][j], receiver_context_ptr->last_parms_id());
-                            }
-                        });
-                        for (auto & thread : threads) thread.join();
-                    }
-                }
-            }
-        });
+                multiplyTree(subtractions[i][j], finals[i][j], receiver_product, receiver_evaluator_ptr, receiver_relinkeys_ptr);
+            });
+
+            // Multiply non-zero random values to the result
+            uint64_t mask = graph.add([&finals, &steps, i, j, &crt, masks, receiver_encoder_ptr, receiver_evaluator_ptr]()
+            {
+                steps[i][j] = multiplyMask(finals[i][j], crt, masks, receiver_encoder_ptr, receiver_evaluator_ptr);
+            });
+            graph.precede(products[j], mask);
+
+            // Rotate it
+            uint64_t rotate_task = graph.add([&finals, &steps, i, j, rotation, receiver_encoder_ptr, receiver_evaluator_ptr, receiver_galoiskeys_ptr]()
+            {
+                if (rotation) rotate(finals[i][j], steps[i][j], receiver_encoder_ptr->slot_count(), receiver_evaluator_ptr, receiver_galoiskeys_ptr);
+            });
+
+            // Modulus switch, and relinearize a lazy product at the lowest level
+            uint64_t mod_switch = graph.add([&finals, i, j, receiver_context_ptr, receiver_evaluator_ptr, receiver_relinkeys_ptr]()
+            {
+                receiver_evaluator_ptr->mod_switch_to_inplace(finals[i][j], receiver_context_ptr->last_parms_id());
+                relinearizeProduct(finals[i][j], receiver_evaluator_ptr, receiver_relinkeys_ptr);
+            });
+
+            // a lazy product is switched down before the rotation, which needs it relinearized
+            if (receiver_product.method == Product::lazy) { graph.precede(mask, mod_switch); graph.precede(mod_switch, rotate_task); }
+            else { graph.precede(mask, rotate_task); graph.precede(rotate_task, mod_switch); }
+        }
+
+        for (uint64_t j=0; j<results[i].size(); j++)
+        {
+            uint64_t group = j < return_width ? j % final_width : final_width;
+            uint64_t position = j < return_width ? j / final_width : 0;
+            uint64_t subtract = graph.add([
+                &subtractions, &results, &randoms, i, j, group, position, sender_decryptor_ptr, sender_encoder_ptr, receiver_encoder_ptr, receiver_evaluator_ptr
+            ]()
+            {
+                // Decrypt the result and encode it under Receiver's key
+                Plaintext sender_result_pt, receiver_result_pt;
+                vector<uint64_t> sender_result;
+                sender_decryptor_ptr->decrypt(results[i][j], sender_result_pt);
+                sender_encoder_ptr->decode(sender_result_pt, sender_result);
+                receiver_encoder_ptr->encode(sender_result, receiver_result_pt);
+
+                // Subtract the random mask
+                receiver_evaluator_ptr->sub_plain(randoms[i][j], receiver_result_pt, subtractions[i][group][position]);
+            });
+            graph.precede(subtract, products[group]);
+        }
     }
-    for (auto & thread : threads) thread.join();
+    executor(num_threads).run(graph);
 }
 
 } // psi
\ No newline at end of file
@@ -1,15 +1,47 @@
 #pragma once
 
 #include <cstdint>
+#include <map>
 #include <vector>
 #include "crt.h"
 #include "kuckoo.h"
+#include "masks.h"
 #include "party.h"
+#include "product.h"
 #include "seal/seal.h"
 
 namespace psi
 {
 
+// Multi-query packing: the Receiver's elements are split into rounds in which no two elements share a cell
+// (slot and CRT component), so each table ciphertext is subtracted once per round with the bins of all its
+// elements, and the elements of a round that hit the same ciphertexts share one result row.
+// A zero in a row is attributed to the owner of its cell, so the Sender must not rotate the results
+struct QueryPlan
+{
+    struct Query // the bin of one element in one table ciphertext
+    {
+        uint64_t slot;
+        uint64_t component;
+        uint64_t value;
+    };
+    struct Round
+    {
+        std::vector<uint64_t> owners; // 1 + index of the element owning each cell (slot * k + component), 0 if none
+        std::map<uint64_t, std::vector<Query>> queries; // by table ciphertext
+    };
+    struct Row
+    {
+        uint64_t round;
+        std::vector<uint64_t> cts; // table ciphertext of each hash function
+    };
+
+    std::vector<Round> rounds;
+    std::vector<Row> rows;
+};
+
+QueryPlan planQueries(const Party & receiver, const cuckoo::Kuckoo & cuckoo, const math::CrtParams & crt, uint64_t n);
+
 void computeIntersection // single-thread
 (
     std::vector<std::vector<seal::Ciphertext>> & results, // return masked intersection under Sender's key
@@ -17,8 +49,10 @@ void computeIntersection // single-thread
     const Party & receiver,
     const cuckoo::Kuckoo & cuckoo,
     const std::vector<seal::Ciphertext> & encrypted_table,
+    bool presubtracted, // the table ciphertexts hold encrypted_table[i] - encode(receiver_dummy), see presubtractTable
     const math::CrtParams & crt,
     uint64_t sender_eta,
+    const fhe::ProductPlan & sender_product, // how the product of each partition is evaluated, and at which levels
     const seal::SEALContext * sender_context_ptr,
     const seal::BatchEncoder * sender_encoder_ptr,
     const seal::Evaluator * sender_evaluator_ptr,
@@ -35,8 +69,10 @@ void computeIntersection // multi-thread
     const Party & receiver,
     const cuckoo::Kuckoo & cuckoo,
     const std::vector<seal::Ciphertext> & encrypted_table,
+    bool presubtracted, // the table ciphertexts hold encrypted_table[i] - encode(receiver_dummy), see presubtractTable
     const math::CrtParams & crt,
     uint64_t sender_eta,
+    const fhe::ProductPlan & sender_product, // how the product of each partition is evaluated, and at which levels
     const seal::SEALContext * sender_context_ptr,
     const seal::BatchEncoder * sender_encoder_ptr,
     const seal::Evaluator * sender_evaluator_ptr,
@@ -44,6 +80,74 @@ void computeIntersection // multi-thread
     const seal::BatchEncoder * receiver_encoder_ptr,
     const seal::Encryptor * receiver_encryptor_ptr,
     uint64_t receiver_dummy,
+    MaskPool * masks, // precomputed masks, used before making new ones; nullptr makes them all
+    uint64_t num_threads
+);
+
+void computeIntersection // multi-query packing, multi-thread, one row of results and randoms per row of the plan
+(
+    std::vector<std::vector<seal::Ciphertext>> & results,
+    std::vector<std::vector<seal::Ciphertext>> & randoms,
+    const QueryPlan & plan,
+    const cuckoo::Kuckoo & cuckoo,
+    const std::vector<seal::Ciphertext> & encrypted_table,
+    bool presubtracted,
+    const math::CrtParams & crt,
+    uint64_t sender_eta,
+    const fhe::ProductPlan & sender_product, // how the product of each partition is evaluated, and at which levels
+    const seal::SEALContext * sender_context_ptr,
+    const seal::BatchEncoder * sender_encoder_ptr,
+    const seal::Evaluator * sender_evaluator_ptr,
+    const seal::RelinKeys * sender_relinkeys_ptr,
+    const seal::BatchEncoder * receiver_encoder_ptr,
+    const seal::Encryptor * receiver_encryptor_ptr,
+    uint64_t receiver_dummy,
+    MaskPool * masks, // precomputed masks, used before making new ones; nullptr makes them all
+    uint64_t num_threads
+);
+
+void encryptTable // multi-thread
+(
+    std::vector<seal::Ciphertext> & encrypted_table, // return table ciphertexts followed by the stash ciphertexts
+    const cuckoo::Kuckoo & cuckoo,
+    const math::CrtParams & crt,
+    const seal::BatchEncoder * encoder_ptr,
+    const seal::Encryptor * encryptor_ptr,
+    uint64_t num_threads
+);
+
+void encryptTable // multi-thread, (re-)encrypts only the ciphertexts in 'indices'
+(
+    std::vector<seal::Ciphertext> & encrypted_table,
+    const cuckoo::Kuckoo & cuckoo,
+    const math::CrtParams & crt,
+    const seal::BatchEncoder * encoder_ptr,
+    const seal::Encryptor * encryptor_ptr,
+    const std::vector<uint64_t> & indices,
+    uint64_t num_threads
+);
+
+void presubtractTable // multi-thread, subtracts the all-'receiver_dummy' plaintext from the table ciphertexts in 'indices'
+(
+    std::vector<seal::Ciphertext> & encrypted_table, // the stash ciphertexts are left as they are
+    const cuckoo::Kuckoo & cuckoo,
+    const math::CrtParams & crt,
+    const seal::BatchEncoder * sender_encoder_ptr,
+    const seal::Evaluator * sender_evaluator_ptr,
+    uint64_t receiver_dummy,
+    const std::vector<uint64_t> & indices,
+    uint64_t num_threads
+);
+
+void switchTable // multi-thread, switches the table ciphertexts in 'indices' down to 'level', which the Receiver's product starts from
+(
+    std::vector<seal::Ciphertext> & encrypted_table, // the stash ciphertexts stay at the first data level for checkStash
+    const cuckoo::Kuckoo & cuckoo,
+    const math::CrtParams & crt,
+    const seal::BatchEncoder * sender_encoder_ptr,
+    const seal::Evaluator * sender_evaluator_ptr,
+    const seal::parms_id_type & level,
+    const std::vector<uint64_t> & indices,
     uint64_t num_threads
 );
 
@@ -53,7 +157,8 @@ std::vector<uint64_t> decryptIntersection // single-thread
     const Party & receiver,
     const math::CrtParams & crt,
     const seal::BatchEncoder * receiver_encoder_ptr,
-    seal::Decryptor * receiver_decryptor_ptr
+    seal::Decryptor * receiver_decryptor_ptr,
+    uint64_t stash_repetitions // 0 if Sender's table has no stash
 );
 
 std::vector<uint64_t> decryptIntersection // multi-thread
@@ -63,6 +168,18 @@ std::vector<uint64_t> decryptIntersection // multi-thread
     const math::CrtParams & crt,
     const seal::BatchEncoder * receiver_encoder_ptr,
     seal::Decryptor * receiver_decryptor_ptr,
+    uint64_t stash_repetitions, // 0 if Sender's table has no stash
+    uint64_t num_threads
+);
+
+std::vector<uint64_t> decryptIntersection // multi-query packing, multi-thread
+(
+    const std::vector<std::vector<seal::Ciphertext>> & finals,
+    const QueryPlan & plan,
+    const Party & receiver,
+    const math::CrtParams & crt,
+    const seal::BatchEncoder * receiver_encoder_ptr,
+    seal::Decryptor * receiver_decryptor_ptr,
     uint64_t num_threads
 );
 
@@ -73,6 +190,9 @@ void recrypt // single-thread
     const std::vector<std::vector<seal::Ciphertext>> & randoms,
     const math::CrtParams & crt,
     uint64_t receiver_eta,
+    const fhe::ProductPlan & receiver_product,
+    bool stash, // the last column of results is the stash check
+    bool rotation, // false for multi-query packing, whose matches the Receiver locates by slot
     const seal::BatchEncoder * sender_encoder_ptr,
     seal::Decryptor * sender_decryptor_ptr,
     const seal::SEALContext * receiver_context_ptr,
@@ -89,6 +209,9 @@ void recrypt // multi-thread
     const std::vector<std::vector<seal::Ciphertext>> & randoms,
     const math::CrtParams & crt,
     uint64_t receiver_eta,
+    const fhe::ProductPlan & receiver_product,
+    bool stash, // the last column of results is the stash check
+    bool rotation, // false for multi-query packing, whose matches the Receiver locates by slot
     const seal::BatchEncoder * sender_encoder_ptr,
     seal::Decryptor * sender_decryptor_ptr,
     const seal::SEALContext * receiver_context_ptr,
@@ -96,6 +219,7 @@ void recrypt // multi-thread
     const seal::Evaluator * receiver_evaluator_ptr,
     const seal::RelinKeys * receiver_relinkeys_ptr,
     const seal::GaloisKeys * receiver_galoiskeys_ptr,
+    RecryptPool * masks, // precomputed masks and rotations, used before making new ones; nullptr makes them all
     uint64_t num_threads
 );
 
@@ -0,0 +1,127 @@
+#include "stash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "crt.h"
+#include "kuckoo.h"
+#include "math.h"
+#include "packing.h"
+#include "random.h"
+#include "seal/seal.h"
+
+using namespace cuckoo;
+using namespace fhe;
+using namespace math;
+using namespace seal;
+using namespace std;
+
+namespace psi
+{
+
+// false positive probability of the stash check is at most 2^-stash_security
+const double stash_security = 40;
+
+static uint64_t chunk(uint64_t value, uint64_t index, uint64_t chunk_bits)
+{
+    return shiftRight(value, index * chunk_bits) & (shiftLeft(1ULL, chunk_bits) - 1ULL);
+}
+
+// the Receiver subtracts its value from every cell and adds up the chunk differences with random weights,
+// so a cell is zero for a matching entry and zero with probability 1/t otherwise
+// cells outside the layout keep the (non-zero) padding of the first chunk
+void checkStash
+(
+    Ciphertext & result,
+    uint64_t value,
+    const vector<Ciphertext> & encrypted_table,
+    const StashLayout & layout,
+    const CrtParams & crt,
+    const BatchEncoder * encoder_ptr,
+    const Evaluator * evaluator_ptr
+)
+{
+    const uint64_t k = crt.mi.size();
+    const uint64_t kn = k * encoder_ptr->slot_count();
+    const uint64_t cells = layout.repetitions * layout.size;
+    const uint64_t first = encrypted_table.size() - layout.num_chunks;
+
+    for (uint64_t j=0; j<layout.num_chunks; j++)
+    {
+        auto random_values = randomVector(cells, 0, crt.M-1);
+        vector<uint64_t> v(kn, 0), w(kn, j == 0);
+        for (uint64_t c=0; c<cells; c++)
+        {
+            v[c] = chunk(value, j, layout.chunk_bits);
+            w[c] = random_values[c] % crt.mi[c % k];
+        }
+        Plaintext pt_v, pt_w;
+        packEncode(pt_v, v, crt, encoder_ptr);
+        packEncode(pt_w, w, crt, encoder_ptr);
+
+        Ciphertext difference;
+        evaluator_ptr->sub_plain(encrypted_table[first + j], pt_v, difference);
+        evaluator_ptr->multiply_plain_inplace(difference, pt_w);
+        if (j == 0) result = difference;
+        else evaluator_ptr->add_inplace(result, difference);
+    }
+}
+
+// empty entries and unused cells hold 2^chunk_bits in the first chunk, which no value can match
+void encryptStash
+(
+    vector<Ciphertext> & vct,
+    const Kuckoo & cuckoo,
+    const CrtParams & crt,
+    const BatchEncoder * encoder_ptr,
+    const Encryptor * encryptor_ptr
+)
+{
+    const uint64_t kn = crt.mi.size() * encoder_ptr->slot_count();
+    const auto layout = stashLayout(cuckoo, crt, encoder_ptr->slot_count());
+    const auto & stash = cuckoo.getStash();
+    const uint64_t cells = layout.repetitions * layout.size;
+    const uint64_t padding = shiftLeft(1ULL, layout.chunk_bits);
+
+    vct.resize(layout.num_chunks);
+    for (uint64_t j=0; j<layout.num_chunks; j++)
+    {
+        vector<uint64_t> vs(kn, j == 0 ? padding : 0);
+        for (uint64_t c=0; c<cells; c++)
+        {
+            uint64_t entry = c % layout.size;
+            if (entry < stash.size()) vs[c] = chunk(stash[entry], j, layout.chunk_bits);
+        }
+        packEncrypt(vct[j], vs, crt, encoder_ptr, encryptor_ptr);
+    }
+}
+
+StashLayout stashLayout(const Kuckoo & cuckoo, const CrtParams & crt, uint64_t n)
+{
+    StashLayout layout;
+    layout.size = cuckoo.getStashSize();
+    if (!layout.size) return layout;
+
+    // chunks must be smaller than every CRT modulus
+    uint64_t min_modulus = *min_element(crt.mi.begin(), crt.mi.end());
+    layout.chunk_bits = flog2(min_modulus);
+    layout.num_chunks = cuckoo.getValueSize() / layout.chunk_bits + bool(cuckoo.getValueSize() % layout.chunk_bits);
+
+    // a non-matching value has R zeros among the R*size cells with probability at most C(R*size, R) / t^R
+    auto log_false_positive = [&layout, min_modulus](uint64_t r) -> double
+    {
+        double cells = r * layout.size;
+        double log_binomial = (lgamma(cells + 1) - lgamma(r + 1) - lgamma(cells - r + 1)) / log(2.0);
+        return log_binomial - r * log2(double(min_modulus));
+    };
+    const uint64_t max_cells = crt.mi.size() * n;
+    layout.repetitions = 1;
+    while ((log_false_positive(layout.repetitions) > -stash_security) && (layout.repetitions * layout.size <= max_cells))
+        layout.repetitions++;
+    if (layout.repetitions * layout.size > max_cells) throw "Stash does not fit in a ciphertext";
+
+    return layout;
+}
+
+} // psi
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "crt.h"
+#include "kuckoo.h"
+#include "seal/seal.h"
+
+namespace psi
+{
+
+// The stash is encrypted into 'num_chunks' ciphertexts appended to the encrypted table,
+// ciphertext j holding the j-th 'chunk_bits' chunk of every stash entry.
+// Each entry is repeated over 'repetitions' cells, so a match shows as that many zeros
+struct StashLayout
+{
+    uint64_t size = 0; // number of stash entries
+    uint64_t repetitions = 0; // 0 if the table has no stash
+    uint64_t chunk_bits = 0;
+    uint64_t num_chunks = 0;
+};
+
+void checkStash
+(
+    seal::Ciphertext & result, // return weighted sum of the chunk differences under Sender's key
+    uint64_t value,
+    const std::vector<seal::Ciphertext> & encrypted_table,
+    const StashLayout & layout,
+    const math::CrtParams & crt,
+    const seal::BatchEncoder * encoder_ptr,
+    const seal::Evaluator * evaluator_ptr
+);
+
+void encryptStash
+(
+    std::vector<seal::Ciphertext> & vct,
+    const cuckoo::Kuckoo & cuckoo,
+    const math::CrtParams & crt,
+    const seal::BatchEncoder * encoder_ptr,
+    const seal::Encryptor * encryptor_ptr
+);
+
+StashLayout stashLayout(const cuckoo::Kuckoo & cuckoo, const math::CrtParams & crt, uint64_t n);
+
+} // psi